@@ -0,0 +1,159 @@
+// compares the text storage backends on synthetic input
+// usage: bench-storage [bytes...], 1 KB, 10 MB and 1 GB by default
+
+#include "buffer.hpp"
+
+#include <chrono>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t seed = 0x2545F491;
+static uint32_t Random() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// lines of 0-120 printable characters
+static char* GenerateText(size_t n) {
+    char* buff = (char*) malloc(n);
+    size_t lineEnd = Random() % 120;
+    for (size_t i = 0; i < n; ++i) {
+        if (i == lineEnd) {
+            buff[i] = '\n';
+            lineEnd = i + 1 + Random() % 120;
+        }
+        else {
+            buff[i] = ' ' + Random() % 95;
+        }
+    }
+    return buff;
+}
+
+static double Millis(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void Report(const char* backend, size_t n, const char* workload, double ms) {
+    printf("%-18s %12zu  %-22s %10.2f ms\n", backend, n, workload, ms);
+}
+
+static CursorPos RandomPos(auto const& text) {
+    CursorPos pos;
+    pos.ln = Random() % text.size();
+    pos.col = Random() % (text[pos.ln].size() + 1);
+    return pos;
+}
+
+template <TextStorage T>
+static void Bench(const char* backend, const char* source, size_t n, void (*setup)(T&) = NULL) {
+    char* buff = (char*) malloc(n);
+    memcpy(buff, source, n);
+    seed = 0x2545F491;
+
+    T text;
+    if (setup != NULL)
+        setup(text);
+    auto start = std::chrono::steady_clock::now();
+    LoadText(text, buff, n);
+    Report(backend, n, "load", Millis(start));
+
+    // typing near the top and in the middle of the document
+    CursorPos positions[2] = { { text.size() > 10 ? (size_t)10 : 0, 0 }, { text.size()/2, 0 } };
+    const char* names[2] = { "type (top)", "type (middle)" };
+    for (int k = 0; k < 2; ++k) {
+        CursorPos pos = positions[k];
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 20000; ++i) {
+            char c = (i % 40 == 39) ? '\n' : 'a' + i % 26;
+            InsertCStr(text, pos, &c, 1);
+        }
+        Report(backend, n, names[k], Millis(start));
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 2000; ++i) {
+        CursorPos pos = RandomPos(text);
+        InsertCStr(text, pos, "\n", 1);
+    }
+    Report(backend, n, "split lines", Millis(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 2000 && text.size() > 4; ++i) {
+        CursorPos begin = RandomPos(text);
+        // the column was drawn for another line
+        if (begin.ln+3 >= text.size()) begin = { 0, 0 };
+        CursorPos end = { begin.ln+3, 0 };
+        EraseBetween(text, begin, end);
+    }
+    Report(backend, n, "erase 3 lines", Millis(start));
+
+    // what drawing a 60x200 viewport reads
+    start = std::chrono::steady_clock::now();
+    size_t sum = 0;
+    for (int i = 0; i < 1000; ++i) {
+        size_t first = Random() % text.size();
+        for (size_t ln = first; ln < first+60 && ln < text.size(); ++ln) {
+            auto const& line = text[ln];
+            for (size_t col = 0; col < 200 && col < line.size(); ++col)
+                sum += line[col];
+        }
+    }
+    Report(backend, n, "scroll", Millis(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100000; ++i)
+        sum += text[Random() % text.size()].size();
+    Report(backend, n, "line lookup", Millis(start));
+
+    // ctrl+arrow through a stretch of the document, then back
+    start = std::chrono::steady_clock::now();
+    CursorPos pos = { text.size()/3, 0 };
+    for (int i = 0; i < 20000; ++i)
+        pos = TextBuffNextBlockPos(text, pos);
+    for (int i = 0; i < 20000; ++i)
+        pos = TextBuffPrevBlockPos(text, pos);
+    sum += pos.ln;
+    Report(backend, n, "block jumps", Millis(start));
+
+    start = std::chrono::steady_clock::now();
+    size_t bytes = TextBytes(text);
+    for (int i = 0; i < 100000; ++i) {
+        CursorPos p = OffsetToPos(text, Random() % (bytes+1));
+        sum += PosToOffset(text, p);
+    }
+    Report(backend, n, "offset lookup", Millis(start));
+
+    start = std::chrono::steady_clock::now();
+    CursorPos end = { text.size()-1, text[text.size()-1].size() };
+    char* out;
+    size_t total;
+    ExtractText(text, (CursorPos) { 0, 0 }, end, &out, &total);
+    sum += out[total/2];
+    free(out);
+    Report(backend, n, "extract all", Millis(start));
+
+    // keep the reads from being optimized away
+    if (sum == 0) printf("\n");
+}
+
+int main(int argc, char** argv) {
+    size_t defaultSizes[] = { 1024, 10*1024*1024, 1024*1024*1024 };
+    size_t numSizes = argc > 1 ? (size_t)(argc-1) : sizeof(defaultSizes)/sizeof(defaultSizes[0]);
+    for (size_t i = 0; i < numSizes; ++i) {
+        size_t n = argc > 1 ? strtoull(argv[i+1], NULL, 10) : defaultSizes[i];
+        char* source = GenerateText(n);
+        Bench<LineVector>("LineVector", source, n);
+        Bench<LineVector>("LineVector+intern", source, n, [](LineVector& text) { text.internLines = true; });
+        Bench<PieceTable>("PieceTable", source, n);
+        Bench<PieceTable>("PieceTable+cold", source, n, [](PieceTable& text) { text.coldMinSize = 0; });
+        Bench<Rope>("Rope", source, n);
+        Bench<ImmerText>("ImmerText", source, n);
+        free(source);
+        printf("\n");
+    }
+    return 0;
+}
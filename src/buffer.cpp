@@ -31,7 +31,8 @@ bool hasSelection(Cursor const& cursor) {
 // static bool isWhitespace(char c) { return c <= ' ' || c > '~'; }
 static bool isText(char c) { return isalnum(c); }
 
-CursorPos TextBuffNextBlockPos(Text const& text, CursorPos cur) {
+template <TextStorage T>
+CursorPos TextBuffNextBlockPos(T const& text, CursorPos cur) {
     // assumes cur is a valid pos
     // wrap if at end of line
     if (cur.col == text[cur.ln].size()) {
@@ -45,11 +46,12 @@ CursorPos TextBuffNextBlockPos(Text const& text, CursorPos cur) {
 
     // this block logic is way simpler than others, mostly because handling all that is pain
     bool seenText = false;
-    for (size_t n = text[cur.ln].size();
+    auto const& line = text[cur.ln];
+    for (size_t n = line.size();
         cur.col < n;
         ++cur.col)
     {
-        char c = text[cur.ln][cur.col];
+        char c = line[cur.col];
         if (isText(c)) {
             seenText = true;
         }
@@ -61,7 +63,8 @@ CursorPos TextBuffNextBlockPos(Text const& text, CursorPos cur) {
     return cur;
 }
 
-CursorPos TextBuffPrevBlockPos(Text const& text, CursorPos cur) {
+template <TextStorage T>
+CursorPos TextBuffPrevBlockPos(T const& text, CursorPos cur) {
     // assumes cur is a valid pos
     // wrap if at end of line
     if (cur.col == 0) {
@@ -75,11 +78,12 @@ CursorPos TextBuffPrevBlockPos(Text const& text, CursorPos cur) {
 
     bool seenText = false;
     --cur.col;
-    for (size_t n = text[cur.ln].size();
+    auto const& line = text[cur.ln];
+    for (size_t n = line.size();
         cur.col < n;
         --cur.col)
     {
-        char c = text[cur.ln][cur.col];
+        char c = line[cur.col];
         if (isText(c)) {
             seenText = true;
         }
@@ -120,23 +124,13 @@ void StopSelecting(Cursor& cursor) {
     cursor.selEnd.ln = cursor.curPos.ln;
 }
 
-void EraseBetween(Text& text, CursorPos begin, CursorPos end) {
-    if (begin.ln == end.ln) {
-        text[begin.ln].erase(text[begin.ln].begin()+begin.col, text[begin.ln].begin()+end.col);
-    }
-    else {
-        assert(end.ln > begin.ln);
-        text[begin.ln].erase(text[begin.ln].begin()+begin.col, text[begin.ln].end());
-        text[begin.ln].insert(text[begin.ln].end(), text[end.ln].begin()+end.col, text[end.ln].end());
-        text.erase(text.begin()+begin.ln+1, text.begin()+end.ln+1);
-    }
-}
-
-void EraseSelection(Text& text, Cursor const& cursor) {
+template <TextStorage T>
+void EraseSelection(T& text, Cursor const& cursor) {
     EraseBetween(text, cursor.selBegin, cursor.selEnd);
 }
 
-void ResetCursor(Text& text, Cursor& cursor, CursorPos begin) {
+template <TextStorage T>
+void ResetCursor(T const& text, Cursor& cursor, CursorPos begin) {
     cursor.curPos.ln = begin.ln;
     size_t cols = text[cursor.curPos.ln].size();
     cursor.curPos.col = begin.col;
@@ -144,46 +138,14 @@ void ResetCursor(Text& text, Cursor& cursor, CursorPos begin) {
         cursor.curPos.col = cols;
 }
 
-void ExtractText(Text& text, CursorPos selBegin, CursorPos selEnd, char** outBuff, size_t* outSize) {
-    size_t n = selEnd.col;
-    for (size_t ln = selBegin.ln;
-        ln < selEnd.ln;
-        ++ln)
-    {
-        n += text[ln].size()+1;
-    }
-    n -= selBegin.col;
+template <TextStorage T>
+void ExtractText(T const& text, CursorPos selBegin, CursorPos selEnd, char** outBuff, size_t* outSize) {
+    size_t n = CountBetween(text, selBegin, selEnd);
     char* buff = (char*) malloc(n+1);
     if (buff == NULL) {
         PANIC_HERE("MALLOC", "Could not allocate text buffer");
     }
-    if (selBegin.ln == selEnd.ln) {
-        if (text[selBegin.ln].data() != NULL) {
-            memcpy(buff,
-                text[selBegin.ln].data() + selBegin.col,
-                selEnd.col - selBegin.col);
-        }
-    }
-    else {
-        size_t i = text[selBegin.ln].size() - selBegin.col;
-        if (text[selBegin.ln].data() != NULL) {
-            memcpy(buff, text[selBegin.ln].data() + selBegin.col, i);
-        }
-        buff[i++] = '\n';
-        for (size_t ln = selBegin.ln+1;
-            ln < selEnd.ln; ++ln)
-        {
-            size_t sz = text[ln].size();
-            if (text[ln].data() != NULL) {
-                memcpy(buff+i, text[ln].data(), sz);
-            }
-            i += sz;
-            buff[i++] = '\n';
-        }
-        if (text[selEnd.ln].data() != NULL) {
-            memcpy(buff+i, text[selEnd.ln].data(), selEnd.col);
-        }
-    }
+    CopyBetween(text, selBegin, selEnd, buff);
     buff[n] = 0;
     *outBuff = buff;
     if (outSize != NULL) {
@@ -191,43 +153,20 @@ void ExtractText(Text& text, CursorPos selBegin, CursorPos selEnd, char** outBuf
     }
 }
 
-void InsertCStr(Text& text, CursorPos& curPos, const char* s, size_t n) {
-    // assumes s is 'clean'
-    std::vector<size_t> lineIdx;
-    for (size_t i = 0; i < n; ++i) {
-        if (s[i] == '\n') {
-            // FIXME: lazy dynamic array, no error checking
-            lineIdx.push_back(i);
-        }
-    }
-    size_t nLines = lineIdx.size();
-    lineIdx.push_back(n);
-
-    if (nLines > 0) {
-        // split line
-        text.insert(text.begin()+curPos.ln+1, nLines, Line{});
-        text[curPos.ln+nLines].insert(text[curPos.ln+nLines].begin(),
-            text[curPos.ln].begin()+curPos.col,
-            text[curPos.ln].end());
-        text[curPos.ln].erase(
-            text[curPos.ln].begin()+curPos.col,
-            text[curPos.ln].end());
-    }
-    text[curPos.ln].insert(
-        text[curPos.ln].begin()+curPos.col,
-        s, s+lineIdx[0]);
-    curPos.col += lineIdx[0];
-    for (size_t i = 0; i < nLines; ++i) {
-        size_t sz = lineIdx[i+1]-lineIdx[i]-1;
-        ++curPos.ln;
-        text[curPos.ln].insert(
-            text[curPos.ln].begin(),
-            s+lineIdx[i]+1, s+lineIdx[i]+1+sz);
-        curPos.col = sz;
-    }
-}
-
-void InsertText(Text& text, CursorPos& curPos, Line const& line, size_t begin, size_t end) {
+template <TextStorage T>
+void InsertText(T& text, CursorPos& curPos, Line const& line, size_t begin, size_t end) {
     InsertCStr(text, curPos, line.data()+begin, end-begin);
 }
 
+#define INSTANTIATE_BUFFER_FUNCTIONS(T) \
+    template CursorPos TextBuffNextBlockPos(T const& text, CursorPos cur); \
+    template CursorPos TextBuffPrevBlockPos(T const& text, CursorPos cur); \
+    template void EraseSelection(T& text, Cursor const& cursor); \
+    template void ResetCursor(T const& text, Cursor& cursor, CursorPos begin); \
+    template void ExtractText(T const& text, CursorPos selBegin, CursorPos selEnd, char** outBuff, size_t* outSize); \
+    template void InsertText(T& text, CursorPos& curPos, Line const& line, size_t begin, size_t end);
+
+INSTANTIATE_BUFFER_FUNCTIONS(LineVector)
+INSTANTIATE_BUFFER_FUNCTIONS(PieceTable)
+INSTANTIATE_BUFFER_FUNCTIONS(Rope)
+INSTANTIATE_BUFFER_FUNCTIONS(ImmerText)
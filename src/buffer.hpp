@@ -1,14 +1,17 @@
 #ifndef BUFFER_H_
 #define BUFFER_H_
 
+#include "config.hpp"
+#include "format.hpp"
+#include "storage.hpp"
+#include "linevector.hpp"
+#include "piecetable.hpp"
+#include "rope.hpp"
+#include "immertext.hpp"
+
 #include <stddef.h>
 #include <stdbool.h>
 #include <vector>
-#include <immer/vector.hpp>
-
-struct CursorPos {
-    size_t ln, col;
-};
 
 struct Cursor {
     CursorPos curPos, curSel;
@@ -17,28 +20,96 @@ struct Cursor {
     bool shiftSelecting, mouseSelecting;
 };
 
-typedef std::vector<char> Line;
-typedef std::vector<Line> Text;
+// the backend the editor is built with, see TEXT_STORAGE
+#if TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+typedef PieceTable Text;
+#elif TEXT_STORAGE == TEXT_STORAGE_ROPE
+typedef Rope Text;
+#elif TEXT_STORAGE == TEXT_STORAGE_IMMER
+typedef ImmerText Text;
+#else
+typedef LineVector Text;
+#endif
 
 struct Buffer {
     Text text;
     Cursor cursor;
+    TextFormat format; // of the file the text was loaded from
 };
 
 
 bool isBetween(size_t ln, size_t col, CursorPos p, CursorPos q);
 bool isSelecting(Cursor const& cursor);
 bool hasSelection(Cursor const& cursor);
-CursorPos TextBuffNextBlockPos(Text const& text, CursorPos cur);
-CursorPos TextBuffPrevBlockPos(Text const& text, CursorPos cur);
 void UpdateSelection(Cursor& cursor);
 void StopSelecting(Cursor& cursor);
-void EraseBetween(Text& text, CursorPos begin, CursorPos end);
-void EraseSelection(Text& text, Cursor const& cursor);
-void ResetCursor(Text& text, Cursor& cursor, CursorPos begin);
-void ExtractText(Text& text, CursorPos selBegin, CursorPos selEnd, char** outBuff, size_t* outSize);
-void InsertCStr(Text& text, CursorPos& curPos, const char* s, size_t n);
-void InsertText(Text& text, CursorPos& curPos, Line const& line, size_t begin, size_t end);
+
+// instantiated in buffer.cpp for every backend
+template <TextStorage T> CursorPos TextBuffNextBlockPos(T const& text, CursorPos cur);
+template <TextStorage T> CursorPos TextBuffPrevBlockPos(T const& text, CursorPos cur);
+template <TextStorage T> void EraseSelection(T& text, Cursor const& cursor);
+template <TextStorage T> void ResetCursor(T const& text, Cursor& cursor, CursorPos begin);
+template <TextStorage T> void ExtractText(T const& text, CursorPos selBegin, CursorPos selEnd, char** outBuff, size_t* outSize);
+template <TextStorage T> void InsertText(T& text, CursorPos& curPos, Line const& line, size_t begin, size_t end);
+
+// columns are bytes, the screen has cells: a tab reaches to the next multiple
+// of TabSize, a utf-8 sequence takes one cell, so does any other byte
+// L is whatever a backend's operator[] gives for a line
+
+static inline bool IsContinuationByte(char c) {
+    return ((unsigned char) c & 0xC0) == 0x80;
+}
+
+static inline size_t CharCells(char c, size_t cell) {
+    size_t tab = TabSize > 0 ? (size_t) TabSize : 1;
+    return c == '\t' ? tab - cell % tab : 1;
+}
+
+// where the char starting at col ends, a utf-8 sequence is stepped over whole
+template <class L>
+size_t NextCharColumn(L const& line, size_t col, TextEncoding encoding) {
+    size_t end = col+1;
+    if (encoding == ENCODING_UTF8 && (unsigned char) line[col] >= 0xC0) {
+        while (end < line.size() && end < col+4 && IsContinuationByte(line[end]))
+            ++end;
+    }
+    return end;
+}
+
+// where the char ending at col starts
+template <class L>
+size_t PrevCharColumn(L const& line, size_t col, TextEncoding encoding) {
+    size_t begin = col-1;
+    if (encoding == ENCODING_UTF8) {
+        while (begin > 0 && col-begin < 4 && IsContinuationByte(line[begin]))
+            --begin;
+        // a stray continuation byte is a char of its own
+        if (begin != col-1 && (unsigned char) line[begin] < 0xC0)
+            begin = col-1;
+    }
+    return begin;
+}
+
+// the cell col is drawn at, counted from the start of the line or from a char
+// start x known to be drawn at cell
+template <class L>
+size_t ScreenColumn(L const& line, size_t col, TextEncoding encoding, size_t x = 0, size_t cell = 0) {
+    for (; x < col && x < line.size(); x = NextCharColumn(line, x, encoding))
+        cell += CharCells(line[x], cell);
+    return cell;
+}
+
+// the column of the char drawn over cell, or the end of the line if it is short,
+// the walk starts at a char start x drawn at cell at, not after cell
+template <class L>
+size_t ColumnAt(L const& line, size_t cell, TextEncoding encoding, size_t x = 0, size_t at = 0) {
+    while (x < line.size()) {
+        at += CharCells(line[x], at);
+        if (at > cell) break;
+        x = NextCharColumn(line, x, encoding);
+    }
+    return x;
+}
 
 
 
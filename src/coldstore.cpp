@@ -0,0 +1,181 @@
+#include "coldstore.hpp"
+
+#include <assert.h>
+#include <string.h>
+
+// LZ4 style block format: sequences of a token (literal count and match
+// length - LZ_MIN_MATCH, 4 bits each, 15 meaning more bytes follow), the
+// literals, then a 2 byte offset back to the match, the last sequence has
+// literals only
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 65535
+
+#define FRAME_RAW 0
+#define FRAME_LZ 1
+
+static uint32_t Hash4(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static char* PutLength(char* out, size_t n) {
+    for (; n >= 255; n -= 255)
+        *out++ = (char) 255;
+    *out++ = (char) n;
+    return out;
+}
+
+static char* PutSequence(char* out, const char* lit, size_t litLen, size_t offset, size_t matchLen) {
+    size_t m = matchLen > 0 ? matchLen - LZ_MIN_MATCH : 0;
+    *out++ = (char)(((litLen < 15 ? litLen : 15) << 4) | (m < 15 ? m : 15));
+    if (litLen >= 15)
+        out = PutLength(out, litLen - 15);
+    memcpy(out, lit, litLen);
+    out += litLen;
+    if (matchLen > 0) {
+        *out++ = (char)(offset & 0xFF);
+        *out++ = (char)(offset >> 8);
+        if (m >= 15)
+            out = PutLength(out, m - 15);
+    }
+    return out;
+}
+
+size_t LZBound(size_t n) {
+    return n + n/255 + 16;
+}
+
+size_t LZCompress(const char* src, size_t n, char* dst) {
+    uint32_t table[1 << LZ_HASH_BITS] = {};
+    char* out = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t h = Hash4(src+i);
+        size_t cand = table[h];
+        table[h] = (uint32_t) i;
+        if (cand < i && i - cand <= LZ_MAX_OFFSET && memcmp(src+cand, src+i, LZ_MIN_MATCH) == 0) {
+            size_t len = LZ_MIN_MATCH;
+            while (i+len < n && src[cand+len] == src[i+len])
+                ++len;
+            out = PutSequence(out, src+anchor, i-anchor, i-cand, len);
+            i += len;
+            anchor = i;
+        }
+        else {
+            ++i;
+        }
+    }
+    out = PutSequence(out, src+anchor, n-anchor, 0, 0);
+    return out - dst;
+}
+
+// returns the decompressed size, or SIZE_MAX if src is malformed
+size_t LZDecompress(const char* src, size_t n, char* dst, size_t cap) {
+    const unsigned char* in = (const unsigned char*) src;
+    const unsigned char* end = in + n;
+    size_t o = 0;
+    while (in < end) {
+        unsigned token = *in++;
+        size_t litLen = token >> 4;
+        if (litLen == 15) {
+            unsigned char b;
+            do {
+                if (in >= end) return SIZE_MAX;
+                b = *in++;
+                litLen += b;
+            } while (b == 255);
+        }
+        if ((size_t)(end-in) < litLen || cap-o < litLen) return SIZE_MAX;
+        memcpy(dst+o, in, litLen);
+        in += litLen;
+        o += litLen;
+        if (in == end) break;
+
+        if (end-in < 2) return SIZE_MAX;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t matchLen = (token & 15);
+        if (matchLen == 15) {
+            unsigned char b;
+            do {
+                if (in >= end) return SIZE_MAX;
+                b = *in++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || cap-o < matchLen) return SIZE_MAX;
+        // byte by byte, the match may overlap what it produces
+        for (size_t k = 0; k < matchLen; ++k, ++o)
+            dst[o] = dst[o-offset];
+    }
+    return o;
+}
+
+std::shared_ptr<ColdStore> ColdCompress(const char* s, size_t n) {
+    std::shared_ptr<ColdStore> store = std::make_shared<ColdStore>();
+    store->size = n;
+    store->packedBytes = 0;
+    std::vector<char> scratch(1 + LZBound(COLD_FRAME_SIZE));
+    for (size_t i = 0; i < n; i += COLD_FRAME_SIZE) {
+        size_t m = n-i < COLD_FRAME_SIZE ? n-i : COLD_FRAME_SIZE;
+        size_t packed = LZCompress(s+i, m, scratch.data()+1);
+        std::vector<char> frame;
+        if (packed < m - m/8) {
+            scratch[0] = FRAME_LZ;
+            frame.assign(scratch.begin(), scratch.begin() + 1 + packed);
+        }
+        else {
+            frame.resize(1 + m);
+            frame[0] = FRAME_RAW;
+            memcpy(frame.data()+1, s+i, m);
+        }
+        store->packedBytes += frame.size();
+        store->frames.push_back(std::move(frame));
+    }
+    return store;
+}
+
+// whatever was cached may be for another store now, so all of it goes
+ColdCache& ColdCache::operator=(ColdCache const&) {
+    for (ColdCacheSlot& slot : slots)
+        slot.frame = SIZE_MAX;
+    ++evictions;
+    return *this;
+}
+
+// the bytes from off up to *frameEnd are contiguous, they stay valid until
+// cache.evictions changes
+const char* ColdBytes(ColdStore const& store, ColdCache& cache, size_t off, size_t* frameEnd) {
+    assert(off < store.size);
+    size_t f = off / COLD_FRAME_SIZE;
+    size_t frameBegin = f * COLD_FRAME_SIZE;
+    *frameEnd = frameBegin + COLD_FRAME_SIZE < store.size ? frameBegin + COLD_FRAME_SIZE : store.size;
+    std::vector<char> const& frame = store.frames[f];
+    if (frame[0] == FRAME_RAW)
+        return frame.data() + 1 + (off - frameBegin);
+
+    ColdCacheSlot* slot = &cache.slots[0];
+    for (ColdCacheSlot& s : cache.slots) {
+        if (s.frame == f) {
+            slot = &s;
+            break;
+        }
+        if (s.lastUse < slot->lastUse)
+            slot = &s;
+    }
+    if (slot->frame != f) {
+        if (slot->frame != SIZE_MAX)
+            ++cache.evictions;
+        slot->raw.resize(COLD_FRAME_SIZE);
+        size_t n = LZDecompress(frame.data()+1, frame.size()-1, slot->raw.data(), COLD_FRAME_SIZE);
+        assert(n == *frameEnd - frameBegin);
+        (void) n;
+        slot->frame = f;
+    }
+    slot->lastUse = ++cache.clock;
+    return slot->raw.data() + (off - frameBegin);
+}
@@ -0,0 +1,47 @@
+#ifndef COLDSTORE_H_
+#define COLDSTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#define COLD_FRAME_SIZE (64*1024)
+#define COLD_CACHE_FRAMES 32
+
+struct ColdCacheSlot {
+    size_t frame = SIZE_MAX;
+    uint64_t lastUse = 0;
+    std::vector<char> raw;
+};
+
+// a read-only block kept compressed in frames, frames that don't compress
+// are stored raw to begin with
+// never changes once compressed, so any number of threads may share it
+struct ColdStore {
+    std::vector<std::vector<char>> frames; // a flag byte, then the payload
+    size_t size;
+    size_t packedBytes;
+};
+
+// the frames of a ColdStore read most recently, raw
+// each reader has its own, a copy starts out empty so a copy of a text can be
+// read on another thread
+struct ColdCache {
+    ColdCacheSlot slots[COLD_CACHE_FRAMES];
+    uint64_t clock = 0;
+    uint64_t evictions = 0; // pointers into evicted frames are stale
+
+    ColdCache() = default;
+    ColdCache(ColdCache const&) {}
+    ColdCache& operator=(ColdCache const&);
+};
+
+std::shared_ptr<ColdStore> ColdCompress(const char* s, size_t n);
+const char* ColdBytes(ColdStore const& store, ColdCache& cache, size_t off, size_t* frameEnd);
+
+size_t LZBound(size_t n);
+size_t LZCompress(const char* src, size_t n, char* dst);
+size_t LZDecompress(const char* src, size_t n, char* dst, size_t cap);
+
+#endif // COLDSTORE_H_
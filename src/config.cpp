@@ -19,6 +19,21 @@ const uint32_t PaletteM = 0xae81ffff;
 const uint32_t PaletteK = 0x6e7066ff;
 
 const int TabSize = 4;
+// share one copy of identical lines, only used with TEXT_STORAGE_LINE_VECTOR
+const bool InternLines = false;
+// ms between keystrokes still undone together
+const unsigned int UndoMergeWindow = 1000;
+// ms ctrl+shift+z/y jump back or forward in the edit history
+const unsigned int UndoTimeStep = 10 * 60 * 1000;
+// bytes of undo history kept in memory, older edits move to a journal file
+const uint64_t UndoMemoryLimit = 64 * 1024 * 1024;
+// keep undo history across sessions in a hidden .undo file next to the file
+const bool PersistUndo = true;
+// journal edits to a hidden .wal file so a crash loses nothing since the last save
+const bool RecoverEdits = true;
+// files at least this big are mapped and shown while they are still being read,
+// with TEXT_STORAGE_PIECE_TABLE only
+const uint64_t LargeFileMinSize = (uint64_t) 256 * 1024 * 1024;
 const bool InvertScrollX = false;
 const bool InvertScrollY = false;
 const int ScrollXMultiplier = 4;
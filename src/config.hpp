@@ -6,6 +6,12 @@
 
 #define SYNTAX_HIGHLIGHT 0
 
+#define TEXT_STORAGE_LINE_VECTOR 0
+#define TEXT_STORAGE_PIECE_TABLE 1
+#define TEXT_STORAGE_ROPE 2
+#define TEXT_STORAGE_IMMER 3
+#define TEXT_STORAGE TEXT_STORAGE_PIECE_TABLE
+
 #define ASCII_PRINTABLE_MIN (' ')
 #define ASCII_PRINTABLE_MAX ('~')
 #define ASCII_PRINTABLE_CNT (ASCII_PRINTABLE_MAX - ASCII_PRINTABLE_MIN + 1)
@@ -34,6 +40,13 @@ extern const uint32_t PaletteM;
 extern const uint32_t PaletteK;
 
 extern const int TabSize;
+extern const bool InternLines;
+extern const unsigned int UndoMergeWindow;
+extern const unsigned int UndoTimeStep;
+extern const uint64_t UndoMemoryLimit;
+extern const bool PersistUndo;
+extern const bool RecoverEdits;
+extern const uint64_t LargeFileMinSize;
 extern const bool InvertScrollX;
 extern const bool InvertScrollY;
 extern const int ScrollXMultiplier;
@@ -4,6 +4,13 @@
 
 #include "gl.hpp"
 #include "file.hpp"
+#include "undo.hpp"
+#include "recovery.hpp"
+#include "largefile.hpp"
+#include "loader.hpp"
+#include "save.hpp"
+#include "watch.hpp"
+#include "reload.hpp"
 
 #if SYNTAX_HIGHLIGHT
 #include "trash-lang/src/tokenizer.h"
@@ -15,9 +22,17 @@
 #include <SDL2/SDL.h>
 
 
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 
+// ms the title says a save went through
+#define SAVE_STATUS_TIME 2000
+
+// bytes between the cell stops kept for a line, and how many lines keep them
+#define CELL_STOP_BYTES 256
+#define CELL_CACHE_LINES 4
+
 
 struct Cell {
     uint32_t glyphIdx; // ascii index
@@ -63,6 +78,28 @@ struct CellBuffer {
     Cell* buff;
 };
 
+// a char start and the cell it is drawn at
+struct CellStop {
+    size_t col, cell;
+};
+
+// where a line is drawn, so finding a cell walks at most CELL_STOP_BYTES of it
+// instead of the whole line, good as long as the text keeps its version
+struct CellLine {
+    uint64_t version; // of the text
+    size_t ln;
+    TextEncoding encoding;
+    bool plain; // no tab and no utf-8 sequence, col == cell
+    std::vector<CellStop> stops; // the first char start past every CELL_STOP_BYTES
+};
+
+enum SaveStatus {
+    SAVE_NONE,
+    SAVE_RUNNING,
+    SAVE_DONE,
+    SAVE_FAILED,
+};
+
 struct Editor {
     Image fontSrc;
     Window window;
@@ -70,9 +107,26 @@ struct Editor {
     CellBuffer cells;
     Filename filename;
 
-    std::vector<Buffer> undoHistory;
-    size_t undoIndex;
+    UndoLog undo;
+    RecoveryLog recovery;
+    LargeFile largeFile; // shown straight from the mapped file if set
+    TextLoader loader;
     Buffer buffer;
+    bool loading; // the text only has the start of the file, it can't be edited
+    Saver saver;
+    uint64_t saveId; // of the newest save queued
+    SaveStatus saveStatus;
+    Uint32 saveTime; // when it finished
+    FileWatch watch;
+    FileStamp diskStamp; // the file as the text last matched it
+    bool diskKnown; // false until the file exists
+    bool diskChanged; // the watch saw a write, not looked at yet
+    bool diskConflict; // the file changed under unsaved edits, Ctrl+R takes it
+
+    bool titleStale;
+
+    CellLine cellLines[CELL_CACHE_LINES]; // the cursor's and the selection's lines mostly
+    size_t cellNext; // the one replaced next
 
     bool isValid;
     bool isUpdated;
@@ -80,29 +134,76 @@ struct Editor {
 
 static Editor ed;
 
-
-// removes all unsupported characters (particularly \r and non-ascii)
-// non restrict buffers, since a common use case is to clean in place
-static void CleanInput(const char* inBuff, size_t inSize, char* outBuff, size_t* outSize) {
-    assert(outBuff != NULL);
-
-    size_t size = 0;
-    for (size_t i = 0; i < inSize; ++i) {
-        char c = inBuff[i];
-        if ((ASCII_PRINTABLE_MIN <= c && c <= ASCII_PRINTABLE_MAX) || (c == '\n')) {
-            outBuff[size++] = c;
+// NULL if the line's stops aren't kept for the text as it is
+static CellLine const* CachedCells(size_t ln) {
+    for (CellLine const& cells : ed.cellLines) {
+        bool built = cells.plain || !cells.stops.empty();
+        if (built && cells.version == ed.buffer.text.version && cells.ln == ln &&
+            cells.encoding == ed.buffer.format.encoding)
+        {
+            return &cells;
         }
-        else if (c == '\t') {
-            // replacing tab with spaces will overflow the buffer
+    }
+    return NULL;
+}
 
-        }
+static CellLine const& CellsOf(size_t ln) {
+    CellLine const* cached = CachedCells(ln);
+    if (cached != NULL) return *cached;
+
+    CellLine& cells = ed.cellLines[ed.cellNext];
+    ed.cellNext = (ed.cellNext+1) % CELL_CACHE_LINES;
+    cells.version = ed.buffer.text.version;
+    cells.ln = ln;
+    cells.encoding = ed.buffer.format.encoding;
+    cells.plain = true;
+    cells.stops.clear();
+    auto const& line = ed.buffer.text[ln];
+    size_t cell = 0;
+    for (size_t x = 0; x < line.size(); x = NextCharColumn(line, x, cells.encoding)) {
+        char c = line[x];
+        if (c == '\t' || (cells.encoding == ENCODING_UTF8 && (unsigned char) c >= 0x80))
+            cells.plain = false;
+        if (x >= cells.stops.size()*CELL_STOP_BYTES)
+            cells.stops.push_back((CellStop) { x, cell });
+        cell += CharCells(c, cell);
     }
+    if (cells.plain) cells.stops.clear();
+    return cells;
+}
 
-    if (outSize != NULL) {
-        *outSize = size;
+// the last stop drawn at or before cell
+static CellStop StopBeforeCell(CellLine const& cells, size_t cell) {
+    size_t lo = 0, hi = cells.stops.size();
+    while (hi-lo > 1) {
+        size_t mid = (lo+hi)/2;
+        if (cells.stops[mid].cell <= cell) lo = mid;
+        else hi = mid;
     }
+    return cells.stops[lo];
+}
+
+// the cell pos is drawn at, colMax keeps one so moving up and down stays in it
+static size_t CursorCell(CursorPos pos) {
+    CellLine const& cells = CellsOf(pos.ln);
+    auto const& line = ed.buffer.text[pos.ln];
+    if (cells.plain) return pos.col < line.size() ? pos.col : line.size();
+    // a stop can be a few bytes past its multiple when a sequence straddles it
+    size_t i = pos.col/CELL_STOP_BYTES;
+    if (i >= cells.stops.size()) i = cells.stops.size()-1;
+    while (i > 0 && cells.stops[i].col > pos.col) --i;
+    CellStop stop = cells.stops[i];
+    return ScreenColumn(line, pos.col, cells.encoding, stop.col, stop.cell);
 }
 
+// the column on line ln drawn over cell, the end of the line if it is short
+static size_t CellColumn(size_t ln, size_t cell) {
+    CellLine const& cells = CellsOf(ln);
+    auto const& line = ed.buffer.text[ln];
+    if (cells.plain) return cell < line.size() ? cell : line.size();
+    CellStop stop = StopBeforeCell(cells, cell);
+    return ColumnAt(line, cell, cells.encoding, stop.col, stop.cell);
+}
 
 static void UpdateBuffer() {
     size_t const lineNumWidth = (size_t)log10((float)ed.buffer.text.size()) + 1;
@@ -135,19 +236,43 @@ static void UpdateBuffer() {
         if (lineNumWidth+1 > ed.window.firstColumn+ed.window.numCols) {
             continue;
         }
-        size_t x = ed.window.firstColumn;
-        for (; x <= ed.window.firstColumn+ed.window.numCols-(lineNumWidth+1) && x < ed.buffer.text[y].size(); ++x) {
-            ed.cells.buff[idx].bgCol = PaletteBG;
-            ed.cells.buff[idx].fgCol = PaletteFG;
+        auto const& line = ed.buffer.text[y];
+        TextEncoding encoding = ed.buffer.format.encoding;
+        size_t lastCell = ed.window.firstColumn+ed.window.numCols-(lineNumWidth+1);
+        // the text is the file byte for byte, a tab is blanks up to the next
+        // stop, a char the font doesn't have is one '?'
+        size_t cell = 0, x = 0;
+        // scrolled right, the cursor's line can skip to a stop before the first cell
+        CellLine const* cells = ed.window.firstColumn > 0 ? CachedCells(y) : NULL;
+        if (cells != NULL && cells->plain) {
+            x = ed.window.firstColumn < line.size() ? ed.window.firstColumn : line.size();
+            cell = x;
+        }
+        else if (cells != NULL) {
+            CellStop stop = StopBeforeCell(*cells, ed.window.firstColumn);
+            x = stop.col;
+            cell = stop.cell;
+        }
+        while (x < line.size() && cell <= lastCell) {
+            char c = line[x];
+            size_t cells = CharCells(c, cell);
+            size_t next = NextCharColumn(line, x, encoding);
+            char glyph = c;
+            if (c == '\t') glyph = ' ';
+            else if (c < ASCII_PRINTABLE_MIN || c > ASCII_PRINTABLE_MAX) glyph = '?';
             // text select
-            if ((ed.buffer.cursor.selEnd.col != x || ed.buffer.cursor.selEnd.ln != y) &&
-                isBetween(y, x, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd))
-            {
-                ed.cells.buff[idx].bgCol = PaletteHL;
+            bool selected = (ed.buffer.cursor.selEnd.col != x || ed.buffer.cursor.selEnd.ln != y) &&
+                isBetween(y, x, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd);
+            for (size_t k = 0; k < cells; ++k, ++cell) {
+                if (cell < ed.window.firstColumn || cell > lastCell) continue;
+                ed.cells.buff[idx].bgCol = selected ? PaletteHL : PaletteBG;
+                ed.cells.buff[idx].fgCol = PaletteFG;
+                ed.cells.buff[idx++].glyphIdx = (k == 0 ? glyph : ' ')-ASCII_PRINTABLE_MIN;
             }
-            ed.cells.buff[idx++].glyphIdx = ed.buffer.text[y][x]-ASCII_PRINTABLE_MIN;
+            x = next;
         }
-        for (; x <= ed.window.firstColumn+ed.window.numCols-(lineNumWidth+1); ++x) {
+        if (cell < ed.window.firstColumn) cell = ed.window.firstColumn;
+        for (; cell <= lastCell; ++cell) {
             ed.cells.buff[idx].bgCol = PaletteBG;
             ed.cells.buff[idx].fgCol = PaletteBG;
             ed.cells.buff[idx++].glyphIdx = 0;
@@ -167,10 +292,17 @@ static void UpdateBuffer() {
         y <= ed.window.firstLine+ed.window.numRows && y < ed.buffer.text.size();
         ++y)
     {
+        // lines aren't necessarily contiguous in storage
+        char* lineBuff;
+        size_t lineSize;
+        ExtractText(ed.buffer.text,
+                (CursorPos) { y, 0 },
+                (CursorPos) { y, ed.buffer.text[y].size() },
+                &lineBuff, &lineSize);
         Tokenizer line = {
             .source = {
-                .size = ed.buffer.text[y].size(),
-                .data = ed.buffer.text[y].data(),
+                .size = lineSize,
+                .data = lineBuff,
             }
         };
 
@@ -213,7 +345,7 @@ static void UpdateBuffer() {
                 default: break;
             }
             // these are ints because horizontal scrolling makes these negative
-            int tx = (int)(line.nextToken.pos.col-1-ed.window.firstColumn+lineNumWidth+1);
+            int tx = (int)(CursorCell((CursorPos) { y, line.nextToken.pos.col-1 })-ed.window.firstColumn+lineNumWidth+1);
             int sz = (int)(line.nextToken.text.size);
             if (line.nextToken.kind == TOKEN_CHAR_LITERAL ||
                 line.nextToken.kind == TOKEN_STRING_LITERAL)
@@ -230,11 +362,12 @@ static void UpdateBuffer() {
                 }
             }
         }
+        free(lineBuff);
     }
 #endif
 
     // cursor
-    size_t cx = ed.buffer.cursor.curPos.col-ed.window.firstColumn+lineNumWidth+1;
+    size_t cx = CursorCell(ed.buffer.cursor.curPos)-ed.window.firstColumn+lineNumWidth+1;
     size_t cy = ed.buffer.cursor.curPos.ln-ed.window.firstLine;
     if (lineNumWidth+1 <= cx && cx <= ed.window.numCols &&
         cy <= ed.window.numRows)
@@ -254,7 +387,7 @@ static void UpdateBuffer() {
         }
     }
     // sel cursor
-    size_t sx = ed.buffer.cursor.curSel.col-ed.window.firstColumn+lineNumWidth+1;
+    size_t sx = CursorCell(ed.buffer.cursor.curSel)-ed.window.firstColumn+lineNumWidth+1;
     size_t sy = ed.buffer.cursor.curSel.ln-ed.window.firstLine;
 
     if (lineNumWidth+1 <= sx && sx <= ed.window.numCols &&
@@ -449,33 +582,257 @@ static void InitializeEditor() {
     // glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); // unbind
 }
 
+static void ShowSave();
+
 static void DestroyEditor() {
     // TODO
+    StopSaver(ed.saver);
+    ShowSave();
+    StopRecovery(ed.recovery);
+    CloseLargeFile(ed.largeFile);
+    StopLoad(ed.loader);
+    StopWatch(ed.watch);
 }
 
-static void PushBufferState() {
-    if (ed.undoIndex+1 < ed.undoHistory.size())
-        ed.undoHistory.erase(ed.undoHistory.begin()+ed.undoIndex+1, ed.undoHistory.end());
-    ed.undoHistory.push_back(ed.buffer);
-    ed.undoIndex = ed.undoHistory.size()-1;
+// a mapped file keeps its \r, only the encoding is worth telling, guessed
+// from the part indexed before it shows, less a sequence it may cut off
+static TextEncoding MappedEncoding() {
+    const char* data = ed.largeFile.block->data;
+    size_t n = ed.largeFile.shown;
+    for (int k = 0; k < 3 && n > 0 && (unsigned char) data[n-1] >= 0x80; ++k) --n;
+    return DetectFormat(data, n).encoding;
+}
+
+// shows whatever more of a mapped file was indexed since the last frame
+static bool ShowLargeFile() {
+#if TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+    size_t start, n;
+    if (!PollLargeFile(ed.largeFile, &start, &n)) return false;
+    AppendOriginal(ed.undo, ed.buffer, start, n);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// the file holds the text as it was at MarkSaved now, or failed to
+static void StampDisk() {
+    ed.diskKnown = StampFile(ed.filename.buff, &ed.diskStamp);
+}
+
+// the file holds the text as of MarkSaved, the history and journal start
+// from it
+static void FollowDisk(uint64_t hash, size_t textSize) {
+    bool mapped = ed.largeFile.block != NULL;
+    if (PersistUndo && !mapped) {
+        char* undoPath = SidecarFilePath(ed.filename.buff, ".undo");
+        if (!SaveUndo(ed.undo, ed.buffer, undoPath, hash, textSize))
+            fprintf(stderr, "WARNING: Couldn't save undo history to '%s'\n", undoPath);
+        free(undoPath);
+    }
+    if (RecoverEdits && !mapped) {
+        RebaseRecovery(ed.recovery, hash, textSize);
+    }
+}
+
+static void FinishSave(int err, int sysErr, uint64_t hash, size_t textSize) {
+    ed.saveStatus = err == 0 ? SAVE_DONE : SAVE_FAILED;
+    ed.saveTime = SDL_GetTicks();
+    ed.titleStale = true;
+    if (err != 0) {
+        fprintf(stderr, "ERROR: Couldn't save '%s': %s\n", ed.filename.buff, strerror(sysErr));
+        return;
+    }
+    // the edits were kept over the change on disk
+    ed.diskConflict = false;
+    StampDisk();
+    FollowDisk(hash, textSize);
+}
+
+// edits since the file was loaded, saved or reloaded last
+static bool HasUnsavedEdits() {
+    return ed.undo.current != ed.undo.saved || !ed.undo.pending.ops.empty();
+}
+
+// a mapped file written over in place can't be diffed against, the text read
+// from it changed along with it, so it is mapped again and shown from the start
+// the undo history goes, it was made on what the file no longer holds
+static bool RemapBuffer(FileStamp stamp) {
+#if TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+    if (HasUnsavedEdits())
+        fprintf(stderr, "WARNING: '%s' was written over in place, unsaved edits to it are lost\n", ed.filename.buff);
+    CloseLargeFile(ed.largeFile);
+    ed.buffer.cursor = Cursor{};
+    ed.window.firstLine = 0;
+    if (OpenLargeFile(ed.largeFile, ed.filename.buff, LargeFileMinSize)) {
+        ed.buffer.format.encoding = MappedEncoding();
+        LoadTextBlock(ed.buffer.text, ed.largeFile.block, ed.largeFile.shown);
+        ResetUndo(ed.undo, ed.buffer);
+    }
+    else {
+        // too small to map now, or gone, read as usual
+        LoadText(ed.buffer.text, NULL, 0);
+        ResetUndo(ed.undo, ed.buffer);
+        ed.loading = true;
+        StartLoad(ed.loader, ed.filename.buff);
+    }
+    ed.diskStamp = stamp;
+    ed.diskKnown = true;
+    ed.diskConflict = false;
+    ed.titleStale = true;
+    return true;
+#else
+    (void) stamp;
+    return false;
+#endif
+}
+
+// the file as stamp says it is now, applied as an edit that can be undone,
+// the cursor and the view stay on the lines they were on
+static bool ReloadBuffer(FileStamp stamp) {
+    bool mapped = ed.largeFile.block != NULL;
+    if (mapped) {
+        WaitLargeFile(ed.largeFile);
+        ShowLargeFile();
+    }
+    bool unsaved = HasUnsavedEdits();
+    std::vector<Hunk> hunks;
+    uint64_t hash = 0;
+    if (ReloadText(ed.undo, ed.buffer, ed.filename.buff, SDL_GetTicks(), hunks, mapped ? NULL : &hash) != 0) {
+        fprintf(stderr, "WARNING: Couldn't reload '%s' after it changed: %s\n", ed.filename.buff, strerror(errno));
+        return false;
+    }
+    if (unsaved && !hunks.empty())
+        fprintf(stderr, "WARNING: '%s' changed on disk and replaced unsaved edits, undo to get them back\n", ed.filename.buff);
+    ed.window.firstLine = ShiftLine(hunks, ed.window.firstLine);
+    if (ed.window.firstLine >= ed.buffer.text.size())
+        ed.window.firstLine = ed.buffer.text.size()-1;
+    ed.diskStamp = stamp;
+    ed.diskKnown = true;
+    ed.diskConflict = false;
+    MarkSaved(ed.undo, ed.buffer);
+    if (RecoverEdits && !mapped) {
+        MarkRecovery(ed.recovery);
+    }
+    FollowDisk(hash, TextBytes(ed.buffer.text));
+    ed.titleStale = true;
+    return !hunks.empty();
+}
+
+// picks up the file written by another program, not while a load or save of
+// our own has it, saves of our own are told apart by their stamp
+// unsaved edits aren't replaced unasked, the title tells of the change until
+// Ctrl+R takes it, see TakeDiskChange, or a save writes over it
+static bool ShowDiskChange() {
+    if (PollWatch(ed.watch)) ed.diskChanged = true;
+    // a writer that keeps the file open isn't seen by the watch until it
+    // closes it, what is mapped is checked every poll
+    if (!ed.diskConflict && LargeFileChanged(ed.largeFile, ed.filename.buff)) ed.diskChanged = true;
+    // the edits were undone since, nothing is in the way anymore
+    if (ed.diskConflict && !HasUnsavedEdits()) ed.diskChanged = true;
+    if (!ed.diskChanged || ed.loading || ed.saveStatus == SAVE_RUNNING) return false;
+    ed.diskChanged = false;
+    FileStamp stamp;
+    // gone, the next save puts it back
+    if (!StampFile(ed.filename.buff, &stamp)) return false;
+    // before the stamp, a save of our own over a file with other hard links
+    // writes it in place too
+    bool remap = LargeFileChanged(ed.largeFile, ed.filename.buff);
+    if (!remap && ed.diskKnown && SameStamp(stamp, ed.diskStamp)) {
+        ed.diskConflict = false;
+        return false;
+    }
+    if (HasUnsavedEdits()) {
+        if (!ed.diskConflict) ed.titleStale = true;
+        ed.diskConflict = true;
+        return false;
+    }
+    return remap ? RemapBuffer(stamp) : ReloadBuffer(stamp);
+}
+
+// the file on disk over unsaved edits, the user asked for it, a reload can
+// still be undone
+static bool TakeDiskChange() {
+    FileStamp stamp;
+    if (ed.loading || ed.saveStatus == SAVE_RUNNING || !StampFile(ed.filename.buff, &stamp)) return false;
+    ed.diskChanged = false;
+    if (LargeFileChanged(ed.largeFile, ed.filename.buff)) return RemapBuffer(stamp);
+    if (ed.diskKnown && SameStamp(stamp, ed.diskStamp)) {
+        ed.diskConflict = false;
+        ed.titleStale = true;
+        return false;
+    }
+    return ReloadBuffer(stamp);
+}
+
+// saves on the saver's worker from a copy of the text, unless wait is set,
+// returns false if the save failed, which only a wait can tell
+static bool SaveBuffer(bool wait) {
+    // a change on disk not picked up yet is first, so it isn't written over
+    // unseen
+    ShowDiskChange();
+    bool mapped = ed.largeFile.block != NULL;
+    if (mapped) {
+        WaitLargeFile(ed.largeFile);
+        ShowLargeFile();
+    }
+    MarkSaved(ed.undo, ed.buffer);
+    if (RecoverEdits && !mapped) {
+        MarkRecovery(ed.recovery);
+    }
+    if (!wait) {
+        ed.saveId = QueueSave(ed.saver, ed.buffer.text, ed.buffer.format.lineEnding);
+        ed.saveStatus = SAVE_RUNNING;
+        ed.titleStale = true;
+        return true;
+    }
+    // the file is replaced rather than written over, so a mapped text that
+    // still reads from it stays valid, and a failed save leaves it as it was
+    uint64_t hash = 0;
+    size_t textSize = 0;
+    int err = SaveText(ed.buffer.text, ed.buffer.format.lineEnding, ed.filename.buff, &hash, &textSize, NULL);
+    FinishSave(err, errno, hash, textSize);
+    return err == 0;
+}
+
+// picks up a save the worker finished, unless a newer one was queued since
+static void ShowSave() {
+    SaveResult r;
+    if (PollSave(ed.saver, &r) && r.id == ed.saveId)
+        FinishSave(r.err, r.sysErr, r.hash, r.size);
 }
 
 static void HandleTextInput(SDL_TextInputEvent const& event) {
+    BeginEdit(ed.undo, ed.buffer.cursor);
     if (hasSelection(ed.buffer.cursor)) {
-        EraseSelection(ed.buffer.text, ed.buffer.cursor);
+        RecordErase(ed.undo, ed.buffer.text, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd);
         ResetCursor(ed.buffer.text, ed.buffer.cursor, ed.buffer.cursor.selBegin);
         StopSelecting(ed.buffer.cursor);
     }
     const char* s = event.text;
     size_t n = strlen(s);
     assert(n == 1); // I'm unsure about this, SDL api is unclear
-    InsertCStr(ed.buffer.text, ed.buffer.cursor.curPos, s, n);
-    ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+    RecordInsert(ed.undo, ed.buffer.text, ed.buffer.cursor.curPos, s, n);
+    ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
+
+    CommitEdit(ed.undo, ed.buffer, SDL_GetTicks());
+}
 
-    PushBufferState();
+static bool IsEditKey(SDL_Keysym const& key) {
+    bool const ctrlPressed = key.mod & KMOD_CTRL;
+    switch (key.sym) {
+        case SDLK_RETURN: case SDLK_TAB: case SDLK_BACKSPACE: case SDLK_DELETE:
+            return true;
+        case SDLK_z: case SDLK_y: case SDLK_s: case SDLK_x: case SDLK_v: case SDLK_r:
+            return ctrlPressed;
+    }
+    return false;
 }
 
 static void HandleKeyDown(SDL_KeyboardEvent const& event) {
+    // the loaded text replaces the one shown while loading, edits would be lost
+    if (ed.loading && IsEditKey(event.keysym)) return;
+    BeginEdit(ed.undo, ed.buffer.cursor);
     // TODO: line move, multi-cursor
     SDL_Keycode code = event.keysym.sym;
     SDL_Keymod mod = (SDL_Keymod) event.keysym.mod;
@@ -483,13 +840,13 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
         shiftPressed = mod & KMOD_SHIFT;
     if (code == SDLK_RETURN) {
         if (hasSelection(ed.buffer.cursor)) {
-            EraseSelection(ed.buffer.text, ed.buffer.cursor);
+            RecordErase(ed.undo, ed.buffer.text, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd);
             ResetCursor(ed.buffer.text, ed.buffer.cursor, ed.buffer.cursor.selBegin);
             StopSelecting(ed.buffer.cursor);
         }
-        InsertCStr(ed.buffer.text, ed.buffer.cursor.curPos, "\n", 1);
-        ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
-        PushBufferState();
+        RecordInsert(ed.undo, ed.buffer.text, ed.buffer.cursor.curPos, "\n", 1);
+        ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
+        CommitEdit(ed.undo, ed.buffer, SDL_GetTicks());
     }
     else if (code == SDLK_TAB) {
         if (shiftPressed && hasSelection(ed.buffer.cursor)) {
@@ -506,7 +863,7 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
                     if (ed.buffer.text[line][nSpaces] != ' ')
                         break;
                 }
-                EraseBetween(ed.buffer.text,
+                RecordErase(ed.undo, ed.buffer.text,
                              (CursorPos) { .ln=line, .col=0 },
                              (CursorPos) { .ln=line, .col=nSpaces });
                 if (line == ed.buffer.cursor.curPos.ln)
@@ -526,7 +883,7 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
                 if (ed.buffer.text[line][nSpaces] != ' ')
                     break;
             }
-            EraseBetween(ed.buffer.text,
+            RecordErase(ed.undo, ed.buffer.text,
                          (CursorPos) { .ln=line, .col=0 },
                          (CursorPos) { .ln=line, .col=nSpaces });
             ed.buffer.cursor.curPos.col -= ed.buffer.cursor.curPos.col > nSpaces ? nSpaces : ed.buffer.cursor.curPos.col;
@@ -539,7 +896,7 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
             {
                 // FIXME: assuming TabSize is less than 32 or so...
                 CursorPos begin = (CursorPos) { .ln=line, .col=0 };
-                InsertCStr(ed.buffer.text, begin,
+                RecordInsert(ed.undo, ed.buffer.text, begin,
                            "                                ", TabSize);
             }
             ed.buffer.cursor.curPos.col += TabSize;
@@ -549,32 +906,31 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
         else {
             // indent line
             CursorPos begin = ed.buffer.cursor.curPos;
-            InsertCStr(ed.buffer.text, begin,
+            RecordInsert(ed.undo, ed.buffer.text, begin,
                        "                                ", TabSize);
             ed.buffer.cursor.curPos.col += TabSize;
-            ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+            ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
         }
-        PushBufferState();
+        CommitEdit(ed.undo, ed.buffer, SDL_GetTicks());
     }
     else if (code == SDLK_BACKSPACE) {
         if (hasSelection(ed.buffer.cursor)) {
-            EraseSelection(ed.buffer.text, ed.buffer.cursor);
+            RecordErase(ed.undo, ed.buffer.text, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd);
             ResetCursor(ed.buffer.text, ed.buffer.cursor, ed.buffer.cursor.selBegin);
             StopSelecting(ed.buffer.cursor);
         }
         else if (ctrlPressed) {
             CursorPos begin = TextBuffPrevBlockPos(ed.buffer.text, ed.buffer.cursor.curPos);
             CursorPos end = ed.buffer.cursor.curPos;
-            EraseBetween(ed.buffer.text, begin, end);
+            RecordErase(ed.undo, ed.buffer.text, begin, end);
             ResetCursor(ed.buffer.text, ed.buffer.cursor, begin);
             StopSelecting(ed.buffer.cursor);
         }
         else {
             if (ed.buffer.cursor.curPos.col >= 1) {
-                ed.buffer.cursor.curPos.col -= 1;
-                EraseBetween(ed.buffer.text,
-                             ed.buffer.cursor.curPos,
-                             (CursorPos) { .ln=ed.buffer.cursor.curPos.ln, .col=ed.buffer.cursor.curPos.col+1 });
+                CursorPos end = ed.buffer.cursor.curPos;
+                ed.buffer.cursor.curPos.col = PrevCharColumn(ed.buffer.text[end.ln], end.col, ed.buffer.format.encoding);
+                RecordErase(ed.undo, ed.buffer.text, ed.buffer.cursor.curPos, end);
             }
             else if (ed.buffer.cursor.curPos.ln != 0) {
                 size_t oldCols = ed.buffer.text[ed.buffer.cursor.curPos.ln-1].size();
@@ -583,43 +939,43 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
                     .col=ed.buffer.text[ed.buffer.cursor.curPos.ln-1].size()
                 };
                 CursorPos end = ed.buffer.cursor.curPos;
-                EraseBetween(ed.buffer.text, begin, end);
+                RecordErase(ed.undo, ed.buffer.text, begin, end);
                 ed.buffer.cursor.curPos.col = oldCols;
                 ed.buffer.cursor.curPos.ln -= 1;
             }
         }
-        ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
-        PushBufferState();
+        ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
+        CommitEdit(ed.undo, ed.buffer, SDL_GetTicks());
     }
     else if (code == SDLK_DELETE) {
         if (hasSelection(ed.buffer.cursor)) {
-            EraseSelection(ed.buffer.text, ed.buffer.cursor);
+            RecordErase(ed.undo, ed.buffer.text, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd);
             ResetCursor(ed.buffer.text, ed.buffer.cursor, ed.buffer.cursor.selBegin);
             StopSelecting(ed.buffer.cursor);
         }
         else if (ctrlPressed) {
             CursorPos begin = ed.buffer.cursor.curPos;
             CursorPos end = TextBuffNextBlockPos(ed.buffer.text, ed.buffer.cursor.curPos);
-            EraseBetween(ed.buffer.text, begin, end);
+            RecordErase(ed.undo, ed.buffer.text, begin, end);
             ResetCursor(ed.buffer.text, ed.buffer.cursor, begin);
             StopSelecting(ed.buffer.cursor);
         }
         else {
             if (ed.buffer.cursor.curPos.col + 1 <= ed.buffer.text[ed.buffer.cursor.curPos.ln].size()) {
-                EraseBetween(ed.buffer.text,
-                             ed.buffer.cursor.curPos,
-                             (CursorPos) { .ln=ed.buffer.cursor.curPos.ln, .col=ed.buffer.cursor.curPos.col+1 });
+                CursorPos begin = ed.buffer.cursor.curPos;
+                size_t end = NextCharColumn(ed.buffer.text[begin.ln], begin.col, ed.buffer.format.encoding);
+                RecordErase(ed.undo, ed.buffer.text, begin, (CursorPos) { .ln=begin.ln, .col=end });
             }
             else if (ed.buffer.cursor.curPos.ln != ed.buffer.text.size()-1) {
                 CursorPos begin = ed.buffer.cursor.curPos;
                 CursorPos end = (CursorPos) {
                     .ln=ed.buffer.cursor.curPos.ln+1,
                     .col=0 };
-                EraseBetween(ed.buffer.text, begin, end);
+                RecordErase(ed.undo, ed.buffer.text, begin, end);
             }
         }
-        ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
-        PushBufferState();
+        ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
+        CommitEdit(ed.undo, ed.buffer, SDL_GetTicks());
     }
     // directional keys
     else if (
@@ -660,14 +1016,15 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
                 }
                 else {
                     if (ed.buffer.cursor.curPos.col >= 1) {
-                        ed.buffer.cursor.curPos.col -= 1;
+                        ed.buffer.cursor.curPos.col = PrevCharColumn(ed.buffer.text[ed.buffer.cursor.curPos.ln],
+                            ed.buffer.cursor.curPos.col, ed.buffer.format.encoding);
                     }
                     else if (ed.buffer.cursor.curPos.ln >= 1) {
                         ed.buffer.cursor.curPos.ln -= 1;
                         ed.buffer.cursor.curPos.col = ed.buffer.text[ed.buffer.cursor.curPos.ln].size();
                     }
                 }
-                ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+                ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
             } break;
             case SDLK_RIGHT: {
                 if (wasSelecting) {
@@ -681,83 +1038,70 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
                 }
                 else {
                     if (ed.buffer.cursor.curPos.col + 1 <= ed.buffer.text[ed.buffer.cursor.curPos.ln].size()) {
-                        ed.buffer.cursor.curPos.col += 1;
+                        ed.buffer.cursor.curPos.col = NextCharColumn(ed.buffer.text[ed.buffer.cursor.curPos.ln],
+                            ed.buffer.cursor.curPos.col, ed.buffer.format.encoding);
                     }
                     else if (ed.buffer.cursor.curPos.ln + 1 < ed.buffer.text.size()) {
                         ed.buffer.cursor.curPos.col = 0;
                         ed.buffer.cursor.curPos.ln += 1;
                     }
                 }
-                ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+                ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
             } break;
             case SDLK_UP: {
                 if (ed.buffer.cursor.curPos.ln >= 1) {
                     ed.buffer.cursor.curPos.ln -= 1;
-                    if (ed.buffer.cursor.curPos.col < ed.buffer.cursor.colMax)
-                        ed.buffer.cursor.curPos.col = ed.buffer.cursor.colMax;
-                    size_t cols = ed.buffer.text[ed.buffer.cursor.curPos.ln].size();
-                    if (ed.buffer.cursor.curPos.col > cols)
-                        ed.buffer.cursor.curPos.col = cols;
+                    ed.buffer.cursor.curPos.col = CellColumn(ed.buffer.cursor.curPos.ln, ed.buffer.cursor.colMax);
                 }
                 else {
                     ed.buffer.cursor.curPos.ln = 0;
                     ed.buffer.cursor.curPos.col = 0;
-                    ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+                    ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
                 }
             } break;
             case SDLK_DOWN: {
                 if (ed.buffer.cursor.curPos.ln + 1 < ed.buffer.text.size()) {
                     ed.buffer.cursor.curPos.ln += 1;
-                    if (ed.buffer.cursor.curPos.col < ed.buffer.cursor.colMax)
-                        ed.buffer.cursor.curPos.col = ed.buffer.cursor.colMax;
-                    size_t cols = ed.buffer.text[ed.buffer.cursor.curPos.ln].size();
-                    if (ed.buffer.cursor.curPos.col > cols)
-                        ed.buffer.cursor.curPos.col = cols;
+                    ed.buffer.cursor.curPos.col = CellColumn(ed.buffer.cursor.curPos.ln, ed.buffer.cursor.colMax);
                 }
                 else {
                     ed.buffer.cursor.curPos.ln = ed.buffer.text.size()-1;
                     ed.buffer.cursor.curPos.col = ed.buffer.text[ed.buffer.cursor.curPos.ln].size();
-                    ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+                    ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
                 }
             } break;
             case SDLK_HOME: {
                 ed.buffer.cursor.curPos.col = 0;
-                ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+                ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
             } break;
             case SDLK_END: {
                 ed.buffer.cursor.curPos.col = ed.buffer.text[ed.buffer.cursor.curPos.ln].size();
-                ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+                ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
             } break;
             default: assert(0 && "Unreachable"); break;
         }
     }
     // TODO: ctrl+d,f
+    else if (code == SDLK_z && ctrlPressed && shiftPressed) {
+        // the buffer as it was UndoTimeStep earlier
+        TimeTravel(ed.undo, ed.buffer, -(int64_t) UndoTimeStep);
+    }
+    else if (code == SDLK_y && ctrlPressed && shiftPressed) {
+        TimeTravel(ed.undo, ed.buffer, UndoTimeStep);
+    }
     else if (code == SDLK_z && ctrlPressed) {
         // undo
-        if (ed.undoIndex > 0) {
-            ed.buffer = ed.undoHistory[--ed.undoIndex];
-        }
+        Undo(ed.undo, ed.buffer);
     }
     else if (code == SDLK_y && ctrlPressed) {
         // redo
-        if (ed.undoIndex+1 < ed.undoHistory.size()) {
-            ed.buffer = ed.undoHistory[++ed.undoIndex];
-        }
+        Redo(ed.undo, ed.buffer);
     }
     else if (code == SDLK_s && ctrlPressed) {
-        // TODO: check the filename immediately before saving as well
-        // this matters if more than one editor is opened at once
-        char* buff;
-        size_t textSize;
-        ExtractText(ed.buffer.text,
-                (CursorPos) { 0, 0 },
-                (CursorPos) { ed.buffer.text.size()-1, ed.buffer.text[ed.buffer.text.size()-1].size() },
-                &buff, &textSize);
-        if (!DoesFileExist(ed.filename.buff)) {
-            assert(CreateFileIfNotExist(ed.filename.buff));
-        }
-        OpenAndWriteFileOrCrash(FilePathRelativeToCWD, ed.filename.buff, buff, textSize);
-        free(buff);
+        SaveBuffer(false);
+    }
+    else if (code == SDLK_r && ctrlPressed) {
+        TakeDiskChange();
     }
     else if (code == SDLK_a && ctrlPressed) {
         ed.buffer.cursor.curSel.col = 0;
@@ -774,17 +1118,17 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
         SDL_SetClipboardText(buff);
         free(buff);
         if (code == SDLK_x) { // cut
-            EraseSelection(ed.buffer.text, ed.buffer.cursor);
+            RecordErase(ed.undo, ed.buffer.text, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd);
             ResetCursor(ed.buffer.text, ed.buffer.cursor, ed.buffer.cursor.selBegin);
             StopSelecting(ed.buffer.cursor);
-            PushBufferState();
+            CommitEdit(ed.undo, ed.buffer, SDL_GetTicks());
         }
     }
     else if (code == SDLK_v && ctrlPressed) {
         // paste
         if (SDL_HasClipboardText()) {
             if (hasSelection(ed.buffer.cursor)) {
-                EraseSelection(ed.buffer.text, ed.buffer.cursor);
+                RecordErase(ed.undo, ed.buffer.text, ed.buffer.cursor.selBegin, ed.buffer.cursor.selEnd);
                 ResetCursor(ed.buffer.text, ed.buffer.cursor, ed.buffer.cursor.selBegin);
                 StopSelecting(ed.buffer.cursor);
             }
@@ -794,12 +1138,24 @@ static void HandleKeyDown(SDL_KeyboardEvent const& event) {
                 SDL_ERROR_HERE();
             }
 
-            size_t n = strlen(clip);
-            CleanInput(clip, n, clip, &n);
+            // the text keeps its bytes, tabs and utf-8 go in as they are, only
+            // a crlf from the clipboard becomes the \n the text has
+            size_t n = StripCarriageReturns(clip, strlen(clip));
+            if (ed.buffer.format.encoding == ENCODING_ASCII) {
+                // the clipboard is utf-8, the buffer is too once it has any
+                for (size_t i = 0; i < n; ++i) {
+                    if ((unsigned char) clip[i] >= 0x80) {
+                        ed.buffer.format.encoding = ENCODING_UTF8;
+                        ed.titleStale = true;
+                        break;
+                    }
+                }
+            }
 
-            InsertCStr(ed.buffer.text, ed.buffer.cursor.curPos, clip, n);
+            RecordInsert(ed.undo, ed.buffer.text, ed.buffer.cursor.curPos, clip, n);
             SDL_free(clip);
-            PushBufferState();
+            ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
+            CommitEdit(ed.undo, ed.buffer, SDL_GetTicks());
         }
     }
     else if ((code == SDLK_EQUALS || code == SDLK_KP_PLUS) && ctrlPressed) {
@@ -830,7 +1186,7 @@ static void ClampBetween(size_t* x, size_t l, size_t n) {
 static void CursorAutoscroll() {
     size_t const lineNumWidth = (size_t)log10((float)ed.buffer.text.size()) + 1;
     ClampBetween(&ed.window.firstLine, ed.buffer.cursor.curPos.ln, ed.window.numRows-1);
-    ClampBetween(&ed.window.firstColumn, ed.buffer.cursor.curPos.col, ed.window.numCols-1-(lineNumWidth+1)); // probably underflows
+    ClampBetween(&ed.window.firstColumn, CursorCell(ed.buffer.cursor.curPos), ed.window.numCols-1-(lineNumWidth+1)); // probably underflows
 }
 
 static void ScreenToCursor(size_t mouseX, size_t mouseY) {
@@ -847,17 +1203,122 @@ static void ScreenToCursor(size_t mouseX, size_t mouseY) {
 
     mouseX += (size_t)(ed.window.firstColumn * charWidth);
     mouseY += (size_t)(ed.window.firstLine * charHeight);
-    ed.buffer.cursor.curPos.col = (size_t)(mouseX / charWidth);
+    size_t cell = (size_t)(mouseX / charWidth);
     ed.buffer.cursor.curPos.ln = (size_t)(mouseY / charHeight);
 
     // clamp y
     if (ed.buffer.cursor.curPos.ln > ed.buffer.text.size()-1)
         ed.buffer.cursor.curPos.ln = ed.buffer.text.size()-1;
 
-    // clamp x
-    size_t maxCols = ed.buffer.text[ed.buffer.cursor.curPos.ln].size();
-    if (ed.buffer.cursor.curPos.col > maxCols)
-        ed.buffer.cursor.curPos.col = maxCols;
+    // the char under the cell, or the end of a short line
+    ed.buffer.cursor.curPos.col = CellColumn(ed.buffer.cursor.curPos.ln, cell);
+}
+
+static CursorPos EndPos(Text const& text) {
+    return (CursorPos) { text.size()-1, text[text.size()-1].size() };
+}
+
+// the whole file is there, its undo history and edit journal can be checked
+// against it, a mapped file goes without them since it is never hashed
+static void FinishLoad(uint64_t sourceHash, size_t sourceLen) {
+    bool mapped = ed.largeFile.block != NULL;
+    ResetUndo(ed.undo, ed.buffer);
+    if (PersistUndo && !mapped) {
+        char* undoPath = SidecarFilePath(ed.filename.buff, ".undo");
+        LoadUndo(ed.undo, ed.buffer, undoPath, sourceHash, sourceLen);
+        free(undoPath);
+    }
+    if (RecoverEdits && !mapped) {
+        // a journal left behind means the last session crashed, its edits go
+        // onto the file before a new journal replaces it
+        char* walPath = SidecarFilePath(ed.filename.buff, ".wal");
+        RecoveryResult r = ReplayRecovery(walPath, sourceHash, sourceLen, ed.undo, ed.buffer, SDL_GetTicks());
+        if (r == RECOVERY_STALE) {
+            fprintf(stderr, "WARNING: '%s' is for another version of the file, edits won't be journaled until it is removed\n", walPath);
+        }
+        else if (r == RECOVERY_REPLAYED && !SaveBuffer(true)) {
+            fprintf(stderr, "WARNING: Couldn't save the recovered edits, '%s' is kept\n", walPath);
+        }
+        else {
+            if (r != RECOVERY_REPLAYED) RebaseRecovery(ed.recovery, sourceHash, sourceLen);
+            if (StartRecovery(ed.recovery, walPath))
+                ed.undo.recovery = &ed.recovery;
+            else
+                fprintf(stderr, "WARNING: Couldn't create edit journal '%s'\n", walPath);
+        }
+        free(walPath);
+    }
+}
+
+// shows what was read since the last frame, then the loaded text once the
+// whole file is in, which starts out the same so the view stays put
+static bool ShowLoad() {
+    if (!ed.loading) return false;
+    std::vector<char> chunk;
+    bool finished = PollLoad(ed.loader, chunk);
+    if (!chunk.empty()) {
+        // how the line endings go is only known once all of it is read, crlf
+        // is undone right away so the lines match, a file that mixes them
+        // shows its \r once loaded
+        size_t n = StripCarriageReturns(chunk.data(), chunk.size());
+        CursorPos end = EndPos(ed.buffer.text);
+        InsertCStr(ed.buffer.text, end, chunk.data(), n);
+    }
+    if (finished) {
+        if (ed.loader.err != 0) {
+            fprintf(stderr, "ERROR: Couldn't read file '%s'\n", ed.filename.buff);
+            DestroyEditor();
+            exit(1);
+        }
+        ed.buffer.text = std::move(ed.loader.text);
+        ed.buffer.format = ed.loader.format;
+        StopLoad(ed.loader);
+        ed.loading = false;
+        FinishLoad(ed.loader.hash, ed.loader.textSize);
+    }
+    return finished || !chunk.empty();
+}
+
+// how much of the file is in yet, or how the last save went, for the title
+static void PrintStatus(char* out, size_t n) {
+    size_t done = 0, total = 0;
+    if (ed.loading) {
+        LoadProgress(ed.loader, &done, &total);
+    }
+    else if (ed.largeFile.block != NULL && ed.largeFile.shown < ed.largeFile.block->size) {
+        done = ed.largeFile.shown;
+        total = ed.largeFile.block->size;
+    }
+    else {
+        bool recent = SDL_GetTicks() - ed.saveTime < SAVE_STATUS_TIME;
+        if (ed.saveStatus == SAVE_RUNNING)
+            snprintf(out, n, " (Saving)");
+        else if (ed.diskConflict)
+            snprintf(out, n, " (Changed on disk, Ctrl+R reloads, Ctrl+S keeps yours)");
+        else if (ed.saveStatus == SAVE_DONE && recent)
+            snprintf(out, n, " (Saved)");
+        else if (ed.saveStatus == SAVE_FAILED)
+            snprintf(out, n, " (Save failed)");
+        else
+            out[0] = 0;
+        return;
+    }
+    if (total > 0) {
+        // a file that grew while it was read can be past its size
+        size_t percent = done >= total ? 100
+            : done <= SIZE_MAX/100 ? done*100 / total
+            : done / (total/100);
+        snprintf(out, n, " (Loading %zu%%)", percent);
+    }
+    else
+        snprintf(out, n, " (Loading %zu MB)", done >> 20);
+}
+
+static void PrintFormat(char* out, size_t n) {
+    if (ed.loading)
+        out[0] = 0;
+    else
+        snprintf(out, n, " [%s, %s]", LineEndingName(ed.buffer.format.lineEnding), EncodingName(ed.buffer.format.encoding));
 }
 
 int main(int argc, char** argv) {
@@ -869,17 +1330,21 @@ int main(int argc, char** argv) {
 
     char fnBuff[64];
     assert(strlen(DefaultFilename) + 25 < 64);
-    char* sourceContents = NULL;
-    size_t sourceLen = 0;
+    bool mapped = false;
 
     if (argc == 2) {
         ed.filename.buff = argv[1];
         ed.filename.size = strlen(argv[1]);
-
-        if (DoesFileExist(ed.filename.buff)) {
-            sourceContents = OpenAndReadFileOrCrash(FilePathRelativeToCWD, ed.filename.buff, &sourceLen);
-            CleanInput(sourceContents, sourceLen, sourceContents, &sourceLen);
-        }
+        // before any of it is read, a write from here on is picked up
+        StampDisk();
+
+#if TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+        // shown as soon as its start is indexed, the rest appears as the
+        // worker gets to it
+        mapped = DoesFileExist(ed.filename.buff) && OpenLargeFile(ed.largeFile, ed.filename.buff, LargeFileMinSize);
+        if (mapped) ed.buffer.format.encoding = MappedEncoding();
+#endif
+        ed.loading = !mapped && DoesFileExist(ed.filename.buff);
     }
     else {
         ed.filename.buff = DefaultFilename;
@@ -893,8 +1358,6 @@ int main(int argc, char** argv) {
             ed.filename.buff = fnBuff;
             ed.filename.size = (size_t) n;
         }
-
-        sourceLen = 0;
     }
 
     InitializeEditor();
@@ -905,38 +1368,59 @@ int main(int argc, char** argv) {
         SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_IBEAM));
     SDL_Cursor const* currentMouseCursor = mouseCursorArrow;
 
-    ed.buffer.text = Text{1};
-    if (sourceLen > 0) {
-        InsertCStr(ed.buffer.text, ed.buffer.cursor.curPos, sourceContents, sourceLen);
-        free(sourceContents);
-    }
+#if TEXT_STORAGE == TEXT_STORAGE_LINE_VECTOR
+    ed.buffer.text.internLines = InternLines;
+    ed.loader.text.internLines = InternLines;
+#endif
+#if TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+    if (mapped) LoadTextBlock(ed.buffer.text, ed.largeFile.block, ed.largeFile.shown);
+    else
+#endif
+    LoadText(ed.buffer.text, NULL, 0);
     ed.buffer.cursor.curPos.col = 0;
     ed.buffer.cursor.curPos.ln = 0;
 
-    ed.undoIndex = 0;
-    PushBufferState();
+    ResetUndo(ed.undo, ed.buffer);
+    StartSaver(ed.saver, ed.filename.buff);
+    StartWatch(ed.watch, ed.filename.buff);
+    if (ed.loading) {
+        // the window is up already, the file shows as it is read
+        StartLoad(ed.loader, ed.filename.buff);
+    }
+    else {
+        FinishLoad(HashText(NULL, 0), 0);
+    }
 
     ed.isUpdated = false;
 
     Uint32 const timestep = 1000 / TargetFPS;
     Uint32 lastSecond = 0, frameCount = 0, updateCount = 0;
+    Uint32 lastFrames = 0, lastUpdates = 0;
 
     for (bool quit = false; !quit;) {
 
         Uint32 startTick = SDL_GetTicks();
         if (startTick > lastSecond + 1000) {
-            char t[1024];
+            lastFrames = frameCount;
+            lastUpdates = updateCount;
+            frameCount = 0;
+            updateCount = 0;
+            lastSecond = startTick;
+            ed.titleStale = true;
+        }
+        if (ed.titleStale) {
+            char t[1024], format[32], status[64];
+            PrintFormat(format, sizeof(format));
+            PrintStatus(status, sizeof(status));
             snprintf(t, 1024,
-                "%s - %.*s (FPS=%d, Updates=%d)",
+                "%s - %.*s%s%s (FPS=%d, Updates=%d)",
 //                 "%s - %.*s:%zu:%zu (FPS=%d, Updates=%d)",
                 ProgramTitle,
-                (int)ed.filename.size, ed.filename.buff,
+                (int)ed.filename.size, ed.filename.buff, format, status,
 //                 ed.buffer.cursor.curPos.ln, ed.buffer.cursor.curPos.col,
-                frameCount, updateCount);
+                lastFrames, lastUpdates);
             SDL_SetWindowTitle(ed.window.handle, t);
-            frameCount = 0;
-            updateCount = 0;
-            lastSecond = startTick;
+            ed.titleStale = false;
         }
 
         SDL_Event e;
@@ -987,7 +1471,7 @@ int main(int argc, char** argv) {
                     size_t mouseY = e.button.y < 0 ? 0 : e.button.y;
 
                     ScreenToCursor(mouseX, mouseY);
-                    ed.buffer.cursor.colMax = ed.buffer.cursor.curPos.col;
+                    ed.buffer.cursor.colMax = CursorCell(ed.buffer.cursor.curPos);
 
                     ed.buffer.cursor.curSel.col = ed.buffer.cursor.curPos.col;
                     ed.buffer.cursor.curSel.ln = ed.buffer.cursor.curPos.ln;
@@ -1042,7 +1526,7 @@ int main(int argc, char** argv) {
 
 
             case SDL_TEXTINPUT: {
-                if (!(SDL_GetModState() & (KMOD_CTRL | KMOD_ALT))) {
+                if (!(SDL_GetModState() & (KMOD_CTRL | KMOD_ALT)) && !ed.loading) {
                     HandleTextInput(e.text);
                     CursorAutoscroll();
                     ed.isUpdated = false;
@@ -1056,6 +1540,15 @@ int main(int argc, char** argv) {
             } break;
         }
 
+        // every one of these runs each frame, a mapped file still being
+        // indexed must not hold off the check of what is on disk
+        bool shownMore = ShowLargeFile();
+        bool loaded = ShowLoad();
+        bool reloaded = ShowDiskChange();
+        if (shownMore || loaded || reloaded) {
+            ed.isUpdated = false;
+        }
+        ShowSave();
         if (!ed.isUpdated) {
             UpdateBuffer();
             ++updateCount;
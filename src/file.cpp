@@ -1,4 +1,5 @@
 #include "file.hpp"
+#include "ioqueue.hpp"
 
 #include "whereami.h"
 
@@ -7,12 +8,20 @@
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <atomic>
+#include <mutex>
 
 #ifdef _WIN32
+#include <windows.h>
 #include <io.h>
+#include <sys/stat.h>
 #define F_OK 0
 #define access _access
 #else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
@@ -38,16 +47,188 @@ char* AbsoluteFilePath(const char* filename) {
     return filePath;
 }
 
-char* OpenAndReadFileOrCrash(FilePath path, const char* filename, size_t* outSize) {
+// CALLS MALLOC, USER NEEDS TO FREE
+// a hidden file next to filename, "dir/name" gives "dir/.name" + ext
+char* SidecarFilePath(const char* filename, const char* ext) {
+    const char* slash = strrchr(filename, '/');
+#ifdef _WIN32
+    const char* backslash = strrchr(filename, '\\');
+    if (backslash != NULL && (slash == NULL || backslash > slash))
+        slash = backslash;
+#endif
+    size_t dirSz = slash != NULL ? (size_t)(slash - filename) + 1 : 0;
+    size_t nameSz = strlen(filename) - dirSz;
+    size_t extSz = strlen(ext);
+    char* path = (char*) malloc(dirSz + 1 + nameSz + extSz + 1);
+    memcpy(path, filename, dirSz);
+    path[dirSz] = '.';
+    memcpy(path+dirSz+1, filename+dirSz, nameSz);
+    memcpy(path+dirSz+1+nameSz, ext, extSz+1);
+    return path;
+}
+
+#ifndef _WIN32
+// a mapped file cut short by another program raises SIGBUS on a read past its
+// new end, for mappings of ours the page is swapped for zeros instead and the
+// mapping marked damaged, see MappingDamaged
+#define GUARDED_MAPPINGS 16
+
+struct GuardedMapping {
+    std::atomic<bool> used{false};
+    std::atomic<uintptr_t> begin{0};
+    std::atomic<size_t> size{0};
+    std::atomic<bool> damaged{false};
+};
+
+static GuardedMapping guardedMappings[GUARDED_MAPPINGS];
+static struct sigaction prevBusAction;
+static uintptr_t pageSize;
+
+static void OnBusError(int sig, siginfo_t* info, void* context) {
+    uintptr_t addr = (uintptr_t) info->si_addr;
+    for (GuardedMapping& g : guardedMappings) {
+        uintptr_t begin = g.begin.load();
+        if (begin == 0 || addr < begin || addr - begin >= g.size.load()) continue;
+        void* page = (void*)(addr & ~(pageSize-1));
+        if (mmap(page, pageSize, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == MAP_FAILED) break;
+        g.damaged = true;
+        return;
+    }
+    // not ours, the read faults again once the handler before is back
+    (void) sig;
+    (void) context;
+    sigaction(SIGBUS, &prevBusAction, NULL);
+}
+
+static void InstallBusHandler() {
+    pageSize = (uintptr_t) sysconf(_SC_PAGESIZE);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = OnBusError;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &prevBusAction);
+}
+
+static bool GuardMapping(const char* data, size_t size) {
+    static std::once_flag installed;
+    std::call_once(installed, InstallBusHandler);
+    for (GuardedMapping& g : guardedMappings) {
+        bool expected = false;
+        if (!g.used.compare_exchange_strong(expected, true)) continue;
+        g.size = size;
+        g.damaged = false;
+        g.begin = (uintptr_t) data;
+        return true;
+    }
+    return false;
+}
+
+static void UnguardMapping(const char* data) {
+    for (GuardedMapping& g : guardedMappings) {
+        if (g.begin.load() != (uintptr_t) data) continue;
+        g.begin = 0;
+        g.used = false;
+        return;
+    }
+}
+#endif
+
+// a read of a mapping from MapFileReadOnly went past the end of its file,
+// the file shrank since, what was read there is zeros
+bool MappingDamaged(const char* data) {
+#ifdef _WIN32
+    (void) data;
+#else
+    for (GuardedMapping const& g : guardedMappings) {
+        if (g.begin.load() == (uintptr_t) data) return g.damaged.load();
+    }
+#endif
+    return false;
+}
+
+// pages of the file are only read once they are touched
+// returns NULL if the file can't be opened or is empty, free with UnmapFile
+const char* MapFileReadOnly(const char* filename, size_t* outSize) {
+#ifdef _WIN32
+    // no mapping here, read it all instead
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) return NULL;
+    char* data = NULL;
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        data = (char*) malloc(size);
+        if (data != NULL && fread(data, 1, size, fp) != (size_t) size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    if (data != NULL) *outSize = size;
+    return data;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    if (!GuardMapping((const char*) data, st.st_size)) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    *outSize = st.st_size;
+    return (const char*) data;
+#endif
+}
+
+void UnmapFile(const char* data, size_t size) {
+    if (data == NULL) return;
+#ifdef _WIN32
+    (void) size;
+    free((void*) data);
+#else
+    UnguardMapping(data);
+    munmap((void*) data, size);
+#endif
+}
+
+// mtime in ns where the platform has it, the inode is 0 on windows
+bool StampFile(const char* filename, FileStamp* out) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(filename, &st) != 0) return false;
+    out->mtime = (uint64_t) st.st_mtime * 1000000000ull;
+#else
+    struct stat st;
+    if (stat(filename, &st) != 0) return false;
+#ifdef __linux__
+    out->mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+#else
+    out->mtime = (uint64_t) st.st_mtime * 1000000000ull;
+#endif
+#endif
+    out->size = st.st_size;
+    out->id = st.st_ino;
+    return true;
+}
+
+bool SameStamp(FileStamp a, FileStamp b) {
+    return a.size == b.size && a.mtime == b.mtime && a.id == b.id;
+}
+
+char* OpenAndReadFileOrCrash(FilePath path, const char* filename, size_t* outSize,
+        FileProgress progress, void* user) {
     char* outBuff;
-    int res = OpenAndReadFile(path, filename, outSize, &outBuff);
+    int res = OpenAndReadFile(path, filename, outSize, &outBuff, progress, user);
     if (res != 0) {
         switch (res) {
             break; case -2: fprintf(stderr, "ERROR: Malloc failed\n");
-            break; case -1: fprintf(stderr, "ERROR: File '%s' was too large (%zu bytes)\n", filename, *outSize);
             break; case  1: fprintf(stderr, "ERROR: Couldn't read file '%s': %s\n", filename, strerror(errno));
-            break; case  2: fprintf(stderr, "ERROR: Unexpected end of file '%s'\n", filename);
             break; case  3: fprintf(stderr, "ERROR: Couldn't read file '%s'\n", filename);
+            break; case  4: fprintf(stderr, "ERROR: Stopped reading file '%s'\n", filename);
             break; default: fprintf(stderr, "ERROR: Unkown error reading file '%s': %s\n", filename, strerror(errno));
         }
         exit(1);
@@ -56,7 +237,8 @@ char* OpenAndReadFileOrCrash(FilePath path, const char* filename, size_t* outSiz
 }
 
 
-int OpenAndReadFile(FilePath path, const char* filename, size_t* outSize, char** outBuff) {
+int OpenAndReadFile(FilePath path, const char* filename, size_t* outSize, char** outBuff,
+        FileProgress progress, void* user) {
     FILE* fp;
     if (path == FilePathRelativeToBin) {
         char* filePath = AbsoluteFilePath(filename);
@@ -67,62 +249,139 @@ int OpenAndReadFile(FilePath path, const char* filename, size_t* outSize, char**
         fp = fopen(filename, "rb");
     }
 
-    int err = ReadFileContents(fp, outSize, outBuff);
+    int err = ReadFileContents(fp, outSize, outBuff, progress, user);
     if (fp) fclose(fp);
     return err;
 }
 
+#ifdef __linux__
+// the first total bytes of a regular file, IO_QUEUE_DEPTH chunks in flight
+// at once, progress only sees a chunk once all before it are in
+// returns how much of the start was read, a short read or an error stops
+// it early, stopped is set if progress did
+static size_t ReadQueued(IoQueue& q, int fd, char* buff, size_t total,
+        FileProgress progress, void* user, bool* stopped) {
+    size_t chunks = (total + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE;
+    std::vector<bool> arrived(chunks);
+    size_t next = 0, contiguous = 0;
+    bool failed = false;
+    *stopped = false;
+    for (;;) {
+        while (!failed && !*stopped && next < chunks) {
+            size_t off = next * FILE_CHUNK_SIZE;
+            size_t n = total - off < FILE_CHUNK_SIZE ? total - off : FILE_CHUNK_SIZE;
+            if (!QueueIo(q, (IoRequest) { IO_READ, fd, buff + off, n, off, next, false })) break;
+            ++next;
+        }
+        IoCompletion c;
+        if (!WaitIo(q, &c)) break;
+        size_t off = c.user * FILE_CHUNK_SIZE;
+        size_t n = total - off < FILE_CHUNK_SIZE ? total - off : FILE_CHUNK_SIZE;
+        if (c.res != (int64_t) n) {
+            failed = true;
+            continue;
+        }
+        arrived[c.user] = true;
+        size_t before = contiguous;
+        while (contiguous < chunks && arrived[contiguous]) ++contiguous;
+        size_t done = contiguous * FILE_CHUNK_SIZE < total ? contiguous * FILE_CHUNK_SIZE : total;
+        if (contiguous > before && !failed && !*stopped && progress != NULL && !progress(buff, done, total, user))
+            *stopped = true;
+    }
+    return contiguous * FILE_CHUNK_SIZE < total ? contiguous * FILE_CHUNK_SIZE : total;
+}
+#endif
+
+// reads FILE_CHUNK_SIZE at a time until the end, so pipes and procfs files,
+// which can't be sized up front, work as well as regular files
+// regular files get one allocation of their size, anything else grows it
 // -2 malloc failed
-// -1 malloc too big
 // 0 success
 // 1 file error (errno)
-// 2 feof
 // 3 ferror
-int ReadFileContents(FILE* fp, size_t* outSize, char** outBuff) {
+// 4 stopped by progress
+int ReadFileContents(FILE* fp, size_t* outSize, char** outBuff, FileProgress progress, void* user) {
     assert(outBuff != NULL);
 
     // open file
     if (fp == NULL) {
         return 1;
     }
-    
-    // get file size
-    if (fseek(fp, 0, SEEK_END) != 0) {
-        return 1;
-    }
-    long size = ftell(fp);
-    if (size == -1L) {
-        return 1;
-    }
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-        return 1;
-    }
 
-    if (outSize != NULL) {
-        *outSize = size;
-    }
-    if (size + 1 >= FILE_MALLOC_CAP) {
-        return -1;
-    }
-    char* buff = (char*) malloc(size + 1);
+    // get file size, if it has one
+    size_t total = 0;
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(fp), &st) == 0 && (st.st_mode & _S_IFREG))
+        total = st.st_size;
+#else
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode))
+        total = st.st_size;
+#endif
+
+    size_t cap = (total > 0 ? total : FILE_CHUNK_SIZE) + 1;
+    char* buff = (char*) malloc(cap);
     if (buff == NULL) {
         return -2;
     }
-    
-    // read content
-    size_t numBytes = fread(buff, 1, size, fp);
-    if (numBytes != (size_t)size) {
-        free(buff);
-        if (feof(fp)) {
-            return 2;
+
+    // read content, regular files start out read through a queue if there is
+    // io_uring, the rest of the way is the same for everything
+    size_t size = 0;
+#ifdef __linux__
+    IoQueue q;
+    if (total > 0 && StartIo(q)) {
+        bool stopped;
+        size = ReadQueued(q, fileno(fp), buff, total, progress, user, &stopped);
+        StopIo(q);
+        if (stopped) {
+            free(buff);
+            return 4;
         }
-        else if (ferror(fp)) {
-            return 3;
+        if (fseek(fp, size, SEEK_SET) != 0) {
+            free(buff);
+            return 1;
         }
-        return 4; // this is probably unreachable
+    }
+#endif
+    for (;;) {
+        if (size + 1 == cap) {
+            // full, only grow if there really is more
+            int c = fgetc(fp);
+            if (c == EOF) break;
+            char* grown = (char*) realloc(buff, cap * 2);
+            if (grown == NULL) {
+                free(buff);
+                return -2;
+            }
+            buff = grown;
+            cap *= 2;
+            buff[size++] = (char) c;
+        }
+        size_t want = cap - 1 - size;
+        if (want > FILE_CHUNK_SIZE) want = FILE_CHUNK_SIZE;
+        size_t got = fread(buff + size, 1, want, fp);
+        size += got;
+        if (progress != NULL && !progress(buff, size, total, user)) {
+            free(buff);
+            return 4;
+        }
+        if (got < want) break;
+    }
+    if (ferror(fp)) {
+        free(buff);
+        return 3;
+    }
+    if (cap > size + 1 + FILE_CHUNK_SIZE) {
+        char* shrunk = (char*) realloc(buff, size + 1);
+        if (shrunk != NULL) buff = shrunk;
     }
     buff[size] = 0;
 
+    if (outSize != NULL) {
+        *outSize = size;
+    }
     // caller is responsible for freeing this
     *outBuff = buff;
     return 0;
@@ -165,5 +424,129 @@ int WriteFileContents(FILE* fp, const char* buff, size_t size) {
     return 0;
 }
 
+// flushes fp and waits until its data is on disk
+bool SyncFile(FILE* fp) {
+    if (fflush(fp) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(fp)) == 0;
+#elif defined(__APPLE__)
+    return fsync(fileno(fp)) == 0;
+#else
+    return fdatasync(fileno(fp)) == 0;
+#endif
+}
+
+// the rename itself is only durable once the directory is synced
+static void SyncParentDirectory(const char* filename) {
+#ifdef _WIN32
+    (void) filename; // MOVEFILE_WRITE_THROUGH took care of it
+#else
+    const char* slash = strrchr(filename, '/');
+    char* dir = slash != NULL ? strndup(filename, slash == filename ? 1 : slash - filename) : strdup(".");
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+#endif
+}
+
+// 0 success
+// 1 file error (errno)
+int OpenAtomicFile(AtomicFile* f, const char* filename) {
+    f->inPlace = false;
+#ifdef _WIN32
+    f->target = strdup(filename);
+#else
+    // a file not there yet is made where filename says
+    f->target = realpath(filename, NULL);
+    if (f->target == NULL) f->target = strdup(filename);
+#endif
+    f->tmpPath = SidecarFilePath(f->target, ".save");
+    f->fp = fopen(f->tmpPath, "wb");
+    if (f->fp == NULL) {
+        int err = errno;
+        free(f->tmpPath);
+        free(f->target);
+        f->tmpPath = f->target = NULL;
+        errno = err;
+        return 1;
+    }
+#ifndef _WIN32
+    // the new file keeps the permissions of the one it replaces
+    struct stat st;
+    if (stat(f->target, &st) == 0) {
+        (void) fchmod(fileno(f->fp), st.st_mode & 07777);
+        f->inPlace = st.st_nlink > 1;
+    }
+#endif
+    return 0;
+}
+
+// writes all of src over dst, which keeps its inode
+static bool CopyFileOver(const char* src, const char* dst) {
+    FILE* in = fopen(src, "rb");
+    if (in == NULL) return false;
+    FILE* out = fopen(dst, "wb");
+    if (out == NULL) {
+        int err = errno;
+        fclose(in);
+        errno = err;
+        return false;
+    }
+    char* buff = (char*) malloc(FILE_CHUNK_SIZE);
+    bool ok = buff != NULL;
+    size_t n;
+    while (ok && (n = fread(buff, 1, FILE_CHUNK_SIZE, in)) > 0)
+        ok = fwrite(buff, 1, n, out) == n;
+    ok = ok && !ferror(in);
+    free(buff);
+    ok = SyncFile(out) && ok;
+    int err = errno;
+    ok = fclose(out) == 0 && ok;
+    fclose(in);
+    if (!ok) errno = err;
+    return ok;
+}
 
+// 0 success, the file has the new contents
+// 1 file error (errno), the file is untouched, unless it was written in place,
+// then the new contents are left in tmpPath
+int CommitAtomicFile(AtomicFile* f) {
+    bool ok = SyncFile(f->fp);
+    ok = fclose(f->fp) == 0 && ok;
+    f->fp = NULL;
+    if (ok && f->inPlace) {
+        ok = CopyFileOver(f->tmpPath, f->target);
+        if (ok) remove(f->tmpPath);
+    }
+    else {
+#ifdef _WIN32
+        ok = ok && MoveFileExA(f->tmpPath, f->target, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+        ok = ok && rename(f->tmpPath, f->target) == 0;
+#endif
+        if (ok) {
+            SyncParentDirectory(f->target);
+        }
+        else {
+            int err = errno;
+            remove(f->tmpPath);
+            errno = err;
+        }
+    }
+    free(f->tmpPath);
+    free(f->target);
+    f->tmpPath = f->target = NULL;
+    return ok ? 0 : 1;
+}
 
+void AbortAtomicFile(AtomicFile* f) {
+    if (f->fp != NULL) fclose(f->fp);
+    f->fp = NULL;
+    if (f->tmpPath != NULL) remove(f->tmpPath);
+    free(f->tmpPath);
+    free(f->target);
+    f->tmpPath = f->target = NULL;
+}
@@ -3,22 +3,62 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
-#define FILE_MALLOC_CAP (64 * 1024)
+// files are read this much at a time, whatever their size
+#define FILE_CHUNK_SIZE (1024 * 1024)
 
 typedef enum {
     FilePathRelativeToBin,
     FilePathRelativeToCWD,
 } FilePath;
 
+// called after every chunk read, buff holds the done bytes read so far until
+// the next call, total is 0 if the size isn't known up front
+// returning false stops reading
+typedef bool (*FileProgress)(const char* buff, size_t done, size_t total, void* user);
+
 bool DoesFileExist(const char* filename);
 bool CreateFileIfNotExist(const char* filename);
 char* AbsoluteFilePath(const char* filename);
+char* SidecarFilePath(const char* filename, const char* ext);
+
+const char* MapFileReadOnly(const char* filename, size_t* outSize);
+void UnmapFile(const char* data, size_t size);
+bool MappingDamaged(const char* data);
+
+// tells a file apart from how it was when last seen, a rename over it or a
+// write to it changes one of these
+typedef struct {
+    uint64_t size, mtime, id;
+} FileStamp;
+
+bool StampFile(const char* filename, FileStamp* out);
+bool SameStamp(FileStamp a, FileStamp b);
+
+char* OpenAndReadFileOrCrash(FilePath path, const char* filename, size_t* outSize,
+        FileProgress progress, void* user);
+int OpenAndReadFile(FilePath path, const char* filename, size_t* outSize, char** outBuff,
+        FileProgress progress, void* user);
+int ReadFileContents(FILE* fp, size_t* outSize, char** outBuff, FileProgress progress, void* user);
+
+// written next to its target and renamed over it once all of it is on disk,
+// so a crash leaves either the old file or the new one, never half of each
+// a symlink is followed to the file it points at, a file with other hard
+// links is copied over instead so they keep seeing it, the copy in tmpPath is
+// only removed once that is on disk too
+typedef struct {
+    FILE* fp;
+    char* tmpPath;
+    char* target; // filename with symlinks resolved
+    bool inPlace;
+} AtomicFile;
 
-char* OpenAndReadFileOrCrash(FilePath path, const char* filename, size_t* outSize);
-int OpenAndReadFile(FilePath path, const char* filename, size_t* outSize, char** outBuff);
-int ReadFileContents(FILE* fp, size_t* outSize, char** outBuff);
+int OpenAtomicFile(AtomicFile* f, const char* filename);
+int CommitAtomicFile(AtomicFile* f);
+void AbortAtomicFile(AtomicFile* f);
+bool SyncFile(FILE* fp);
 
 void OpenAndWriteFileOrCrash(FilePath path, const char* filename, const char* buff, size_t size);
 int OpenAndWriteFile(FilePath path, const char* filename, const char* buff, size_t size);
@@ -0,0 +1,217 @@
+#include "format.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define FORMAT_X86 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define UTF8_INVALID SIZE_MAX
+
+// what a pass over the text found so far
+struct FormatScan {
+    size_t lf, crlf; // crlf counted where the \r is
+    size_t checked; // valid utf-8 up to here, ascii blocks skipped count too
+    bool high; // a byte past 0x7f
+    bool invalid;
+};
+
+static int PopCount(uint32_t x) {
+#ifdef _MSC_VER
+    return (int) __popcnt(x);
+#else
+    return __builtin_popcount(x);
+#endif
+}
+
+// checks the sequences starting in [pos, end), the last may run past end,
+// returns where the next one starts or UTF8_INVALID
+static size_t ValidateUtf8(const uint8_t* s, size_t n, size_t pos, size_t end) {
+    while (pos < end) {
+        uint8_t c = s[pos];
+        if (c < 0x80) {
+            ++pos;
+            continue;
+        }
+        size_t len;
+        uint8_t lo = 0x80, hi = 0xBF; // allowed for the second byte
+        if (c >= 0xC2 && c <= 0xDF) len = 2;
+        else if (c >= 0xE0 && c <= 0xEF) {
+            len = 3;
+            if (c == 0xE0) lo = 0xA0; // overlong
+            if (c == 0xED) hi = 0x9F; // surrogates
+        }
+        else if (c >= 0xF0 && c <= 0xF4) {
+            len = 4;
+            if (c == 0xF0) lo = 0x90; // overlong
+            if (c == 0xF4) hi = 0x8F; // past U+10FFFF
+        }
+        else return UTF8_INVALID;
+        if (n - pos < len) return UTF8_INVALID;
+        if (s[pos+1] < lo || s[pos+1] > hi) return UTF8_INVALID;
+        for (size_t k = 2; k < len; ++k)
+            if ((s[pos+k] & 0xC0) != 0x80) return UTF8_INVALID;
+        pos += len;
+    }
+    return pos;
+}
+
+// a block had bytes past 0x7f, validates through to its end
+static void CheckBlock(const char* s, size_t n, size_t i, size_t end, FormatScan* f) {
+    f->high = true;
+    if (f->invalid) return;
+    f->checked = ValidateUtf8((const uint8_t*) s, n, f->checked > i ? f->checked : i, end);
+    f->invalid = f->checked == UTF8_INVALID;
+}
+
+static void ScanScalar(const char* s, size_t n, size_t i, FormatScan* f) {
+    size_t begin = i;
+    bool high = false;
+    for (; i < n; ++i) {
+        char c = s[i];
+        if (c == '\n') ++f->lf;
+        else if (c == '\r' && i+1 < n && s[i+1] == '\n') ++f->crlf;
+        high = high || (uint8_t) c >= 0x80;
+    }
+    if (high) CheckBlock(s, n, begin, n, f);
+}
+
+#ifdef FORMAT_X86
+
+// the load one byte on pairs each \r with what follows it, so blocks stop a
+// byte short of the end
+static void ScanSSE2(const char* s, size_t n, size_t i, FormatScan* f) {
+    __m128i const lf = _mm_set1_epi8('\n');
+    __m128i const cr = _mm_set1_epi8('\r');
+    for (; i+17 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i const*)(s+i));
+        __m128i next = _mm_loadu_si128((__m128i const*)(s+i+1));
+        uint32_t lfMask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        uint32_t crMask = (uint32_t) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(next, lf)));
+        f->lf += PopCount(lfMask);
+        f->crlf += PopCount(crMask);
+        if (_mm_movemask_epi8(v) != 0) CheckBlock(s, n, i, i+16, f);
+    }
+    ScanScalar(s, n, i, f);
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static void ScanAVX2(const char* s, size_t n, size_t i, FormatScan* f) {
+    __m256i const lf = _mm256_set1_epi8('\n');
+    __m256i const cr = _mm256_set1_epi8('\r');
+    for (; i+33 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)(s+i));
+        __m256i next = _mm256_loadu_si256((__m256i const*)(s+i+1));
+        uint32_t lfMask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        uint32_t crMask = (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(next, lf)));
+        f->lf += PopCount(lfMask);
+        f->crlf += PopCount(crMask);
+        if (_mm256_movemask_epi8(v) != 0) CheckBlock(s, n, i, i+32, f);
+    }
+    ScanScalar(s, n, i, f);
+}
+
+#endif // FORMAT_X86
+
+typedef void (*ScanKernel)(const char* s, size_t n, size_t i, FormatScan* f);
+
+// the widest the CPU running this supports, whatever the build targets
+static ScanKernel PickKernel() {
+#ifdef FORMAT_X86
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return ScanAVX2;
+#elif defined(__AVX2__)
+    return ScanAVX2;
+#endif
+    return ScanSSE2;
+#else
+    return ScanScalar;
+#endif
+}
+
+// one pass counting line endings and validating utf-8, ascii blocks only
+// cost the compares
+TextFormat DetectFormat(const char* s, size_t n) {
+    static ScanKernel const kernel = PickKernel();
+    FormatScan f = {};
+    kernel(s, n, 0, &f);
+
+    TextFormat format;
+    if (f.lf == 0 || f.crlf == 0) format.lineEnding = LINE_ENDING_LF;
+    else if (f.crlf == f.lf) format.lineEnding = LINE_ENDING_CRLF;
+    else format.lineEnding = LINE_ENDING_MIXED;
+    if (!f.high) format.encoding = ENCODING_ASCII;
+    else if (!f.invalid) format.encoding = ENCODING_UTF8;
+    else format.encoding = ENCODING_BINARY;
+    return format;
+}
+
+// in place, a file read as is, returns its size as text
+// only uniform crlf line endings are taken apart, everything else stays as
+// it was so that saving it back changes nothing
+size_t DecodeText(char* buff, size_t n, TextFormat* format) {
+    *format = DetectFormat(buff, n);
+    if (format->lineEnding == LINE_ENDING_CRLF)
+        return StripCarriageReturns(buff, n);
+    return n;
+}
+
+// in place, drops every \r right before a \n, returns the new size
+size_t StripCarriageReturns(char* s, size_t n) {
+    char* out = s;
+    const char* p = s;
+    const char* end = s + n;
+    for (const char* r; (r = (const char*) memchr(p, '\r', end - p)) != NULL; p = r + 1) {
+        bool pair = r+1 < end && r[1] == '\n';
+        size_t keep = r - p + (pair ? 0 : 1);
+        memmove(out, p, keep);
+        out += keep;
+    }
+    memmove(out, p, end - p);
+    return out + (end - p) - s;
+}
+
+// text back to how the file had it, out needs 2*n for crlf, returns its size
+size_t EncodeLineEndings(const char* in, size_t n, char* out, LineEnding lineEnding) {
+    if (lineEnding != LINE_ENDING_CRLF) {
+        memcpy(out, in, n);
+        return n;
+    }
+    char* o = out;
+    const char* p = in;
+    const char* end = in + n;
+    for (const char* nl; (nl = (const char*) memchr(p, '\n', end - p)) != NULL; p = nl + 1) {
+        memcpy(o, p, nl - p);
+        o += nl - p;
+        *o++ = '\r';
+        *o++ = '\n';
+    }
+    memcpy(o, p, end - p);
+    return o + (end - p) - out;
+}
+
+const char* LineEndingName(LineEnding lineEnding) {
+    switch (lineEnding) {
+        case LINE_ENDING_LF: return "LF";
+        case LINE_ENDING_CRLF: return "CRLF";
+        case LINE_ENDING_MIXED: return "Mixed";
+    }
+    return "";
+}
+
+const char* EncodingName(TextEncoding encoding) {
+    switch (encoding) {
+        case ENCODING_ASCII: return "ASCII";
+        case ENCODING_UTF8: return "UTF-8";
+        case ENCODING_BINARY: return "Binary";
+    }
+    return "";
+}
@@ -0,0 +1,31 @@
+#ifndef FORMAT_H_
+#define FORMAT_H_
+
+#include <stddef.h>
+
+enum LineEnding {
+    LINE_ENDING_LF,
+    LINE_ENDING_CRLF, // every \n had a \r before it, dropped on load and put back on save
+    LINE_ENDING_MIXED, // some \n did, the \r are kept in the text as they are
+};
+
+enum TextEncoding {
+    ENCODING_ASCII,
+    ENCODING_UTF8,
+    ENCODING_BINARY, // not valid utf-8, kept byte for byte all the same
+};
+
+// what a file was found to be when loaded, it is written back the same way
+struct TextFormat {
+    LineEnding lineEnding = LINE_ENDING_LF;
+    TextEncoding encoding = ENCODING_ASCII;
+};
+
+TextFormat DetectFormat(const char* s, size_t n);
+size_t DecodeText(char* buff, size_t n, TextFormat* format);
+size_t StripCarriageReturns(char* s, size_t n);
+size_t EncodeLineEndings(const char* in, size_t n, char* out, LineEnding lineEnding);
+const char* LineEndingName(LineEnding lineEnding);
+const char* EncodingName(TextEncoding encoding);
+
+#endif // FORMAT_H_
@@ -0,0 +1,135 @@
+#include "immertext.hpp"
+
+#include <immer/algorithm.hpp>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static LineIndex const& Index(ImmerText const& text) {
+    if (!text.index) {
+        text.index = std::make_unique<LineIndex>();
+        for (ImmerLine const& line : text.lines)
+            IndexAppendLine(*text.index, line.size());
+        IndexFinishLines(*text.index);
+    }
+    return *text.index;
+}
+
+// NULL while there is no index to keep up to date
+static LineIndex* MutableIndex(ImmerText& text) {
+    return text.index.get();
+}
+
+// takes ownership of buff
+void LoadText(ImmerText& text, char* buff, size_t n) {
+    text.version = NextTextVersion();
+    auto lines = immer::flex_vector<ImmerLine>{}.transient();
+    size_t begin = 0;
+    for (const char* p = buff;
+        n > 0 && (p = (const char*) memchr(p, '\n', n - (p-buff))) != NULL;
+        ++p)
+    {
+        size_t end = p - buff;
+        lines.push_back(ImmerLine(buff+begin, buff+end));
+        begin = end+1;
+    }
+    lines.push_back(ImmerLine(buff+begin, buff+n));
+    text.lines = lines.persistent();
+    text.index.reset();
+    free(buff);
+}
+
+void InsertCStr(ImmerText& text, CursorPos& curPos, const char* s, size_t n) {
+    text.version = NextTextVersion();
+    ImmerLine line = text.lines[curPos.ln];
+    const char* nl = (const char*) memchr(s, '\n', n);
+    if (nl == NULL) {
+        text.lines = text.lines.set(curPos.ln,
+            line.take(curPos.col) + ImmerLine(s, s+n) + line.drop(curPos.col));
+        if (LineIndex* index = MutableIndex(text))
+            IndexSetLine(*index, curPos.ln, line.size() + n);
+        curPos.col += n;
+        return;
+    }
+
+    // split line
+    auto inserted = immer::flex_vector<ImmerLine>{}.transient();
+    inserted.push_back(line.take(curPos.col) + ImmerLine(s, nl));
+    const char* begin = nl+1;
+    while ((nl = (const char*) memchr(begin, '\n', n - (begin-s))) != NULL) {
+        inserted.push_back(ImmerLine(begin, nl));
+        begin = nl+1;
+    }
+    size_t lastSize = n - (begin-s);
+    inserted.push_back(ImmerLine(begin, s+n) + line.drop(curPos.col));
+    size_t nLines = inserted.size()-1;
+
+    text.lines = text.lines.take(curPos.ln) + inserted.persistent() + text.lines.drop(curPos.ln+1);
+    if (LineIndex* index = MutableIndex(text)) {
+        IndexInsertLines(*index, curPos.ln+1, nLines);
+        for (size_t i = 0; i <= nLines; ++i)
+            IndexSetLine(*index, curPos.ln+i, text.lines[curPos.ln+i].size());
+    }
+    curPos.ln += nLines;
+    curPos.col = lastSize;
+}
+
+void EraseBetween(ImmerText& text, CursorPos begin, CursorPos end) {
+    text.version = NextTextVersion();
+    if (begin.ln == end.ln) {
+        ImmerLine line = text.lines[begin.ln];
+        text.lines = text.lines.set(begin.ln, line.take(begin.col) + line.drop(end.col));
+        if (LineIndex* index = MutableIndex(text))
+            IndexSetLine(*index, begin.ln, line.size() - (end.col-begin.col));
+    }
+    else {
+        assert(end.ln > begin.ln);
+        ImmerLine joined = text.lines[begin.ln].take(begin.col) + text.lines[end.ln].drop(end.col);
+        text.lines = text.lines.take(begin.ln).push_back(joined) + text.lines.drop(end.ln+1);
+        if (LineIndex* index = MutableIndex(text)) {
+            IndexEraseLines(*index, begin.ln+1, end.ln-begin.ln);
+            IndexSetLine(*index, begin.ln, joined.size());
+        }
+    }
+}
+
+size_t CountBetween(ImmerText const& text, CursorPos begin, CursorPos end) {
+    return PosToOffset(text, end) - PosToOffset(text, begin);
+}
+
+size_t PosToOffset(ImmerText const& text, CursorPos pos) {
+    return IndexOffset(Index(text), pos);
+}
+
+CursorPos OffsetToPos(ImmerText const& text, size_t offset) {
+    return IndexPosition(Index(text), offset);
+}
+
+size_t TextBytes(ImmerText const& text) {
+    return IndexBytes(Index(text));
+}
+
+static char* CopyLine(ImmerLine const& line, size_t begin, size_t end, char* out) {
+    immer::for_each_chunk(line.take(end).drop(begin), [&](const char* first, const char* last) {
+        memcpy(out, first, last-first);
+        out += last-first;
+    });
+    return out;
+}
+
+void CopyBetween(ImmerText const& text, CursorPos begin, CursorPos end, char* out) {
+    if (begin.ln == end.ln) {
+        CopyLine(text.lines[begin.ln], begin.col, end.col, out);
+        return;
+    }
+    out = CopyLine(text.lines[begin.ln], begin.col, text.lines[begin.ln].size(), out);
+    *out++ = '\n';
+    for (size_t ln = begin.ln+1;
+        ln < end.ln; ++ln)
+    {
+        out = CopyLine(text.lines[ln], 0, text.lines[ln].size(), out);
+        *out++ = '\n';
+    }
+    CopyLine(text.lines[end.ln], 0, end.col, out);
+}
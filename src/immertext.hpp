@@ -0,0 +1,46 @@
+#ifndef IMMERTEXT_H_
+#define IMMERTEXT_H_
+
+#include "storage.hpp"
+#include "lineindex.hpp"
+
+#include <immer/flex_vector.hpp>
+
+#include <memory>
+
+typedef immer::flex_vector<char> ImmerLine;
+
+// persistent vector of persistent lines, copies share structure, so copying
+// a whole buffer is O(1) and an edit only allocates O(log n) new nodes
+// the line index isn't persistent, a copy starts without one and builds its
+// own from the lines on first use, so neither side copies it on an edit
+struct ImmerText {
+    immer::flex_vector<ImmerLine> lines = { ImmerLine{} };
+    mutable std::unique_ptr<LineIndex> index;
+    uint64_t version = 0; // see NextTextVersion
+
+    ImmerText() = default;
+    ImmerText(ImmerText const& other) : lines(other.lines), version(other.version) {}
+    ImmerText(ImmerText&&) = default;
+    ImmerText& operator=(ImmerText const& other) {
+        lines = other.lines;
+        index.reset();
+        version = other.version;
+        return *this;
+    }
+    ImmerText& operator=(ImmerText&&) = default;
+
+    size_t size() const { return lines.size(); }
+    ImmerLine const& operator[](size_t ln) const { return lines[ln]; }
+};
+
+void LoadText(ImmerText& text, char* buff, size_t n);
+void InsertCStr(ImmerText& text, CursorPos& curPos, const char* s, size_t n);
+void EraseBetween(ImmerText& text, CursorPos begin, CursorPos end);
+size_t CountBetween(ImmerText const& text, CursorPos begin, CursorPos end);
+size_t PosToOffset(ImmerText const& text, CursorPos pos);
+CursorPos OffsetToPos(ImmerText const& text, size_t offset);
+size_t TextBytes(ImmerText const& text);
+void CopyBetween(ImmerText const& text, CursorPos begin, CursorPos end, char* out);
+
+#endif // IMMERTEXT_H_
@@ -0,0 +1,245 @@
+#include "ioqueue.hpp"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+
+// no liburing, the two calls it wraps are all that is needed
+static int RingSetup(unsigned entries, struct io_uring_params* p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int RingEnter(int ring, unsigned submit, unsigned wait, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, ring, submit, wait, flags, NULL, 0);
+}
+
+static unsigned* RingField(void* map, unsigned offset) {
+    return (unsigned*) ((char*) map + offset);
+}
+
+static bool StartRing(IoQueue& q) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int ring = RingSetup(IO_QUEUE_DEPTH, &p);
+    if (ring < 0) return false;
+    // plain read and write ops came with the same kernel as this
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring);
+        return false;
+    }
+
+    q.sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    q.cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) q.sqMapSize = q.cqMapSize = q.sqMapSize > q.cqMapSize ? q.sqMapSize : q.cqMapSize;
+    q.sqMap = mmap(NULL, q.sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    q.cqMap = single ? q.sqMap : mmap(NULL, q.cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    void* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (q.sqMap == MAP_FAILED || q.cqMap == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqes != MAP_FAILED) munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+        if (q.cqMap != MAP_FAILED && !single) munmap(q.cqMap, q.cqMapSize);
+        if (q.sqMap != MAP_FAILED) munmap(q.sqMap, q.sqMapSize);
+        q.sqMap = q.cqMap = NULL;
+        close(ring);
+        return false;
+    }
+
+    q.ring = ring;
+    q.entries = p.sq_entries;
+    q.sqes = (io_uring_sqe*) sqes;
+    q.sqHead = RingField(q.sqMap, p.sq_off.head);
+    q.sqTail = RingField(q.sqMap, p.sq_off.tail);
+    q.sqMask = RingField(q.sqMap, p.sq_off.ring_mask);
+    q.sqArray = RingField(q.sqMap, p.sq_off.array);
+    q.cqHead = RingField(q.cqMap, p.cq_off.head);
+    q.cqTail = RingField(q.cqMap, p.cq_off.tail);
+    q.cqMask = RingField(q.cqMap, p.cq_off.ring_mask);
+    q.cqes = (io_uring_cqe*) ((char*) q.cqMap + p.cq_off.cqes);
+    q.queuedTail = *q.sqTail;
+    return true;
+}
+
+static void QueueRing(IoQueue& q, IoRequest const& r) {
+    if (r.linked && q.queuedTail != __atomic_load_n(q.sqHead, __ATOMIC_ACQUIRE)) {
+        // the kernel hasn't taken the one before yet, it holds this one back
+        unsigned prev = (q.queuedTail - 1) & *q.sqMask;
+        q.sqes[prev].flags |= IOSQE_IO_LINK;
+    }
+    unsigned idx = q.queuedTail & *q.sqMask;
+    struct io_uring_sqe* sqe = &q.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    switch (r.op) {
+        case IO_READ: sqe->opcode = IORING_OP_READ; break;
+        case IO_WRITE: sqe->opcode = IORING_OP_WRITE; break;
+        case IO_SYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            break;
+    }
+    sqe->fd = r.fd;
+    sqe->off = r.offset;
+    sqe->addr = (uint64_t) (uintptr_t) r.buff;
+    sqe->len = (uint32_t) r.n;
+    sqe->user_data = r.user;
+    q.sqArray[idx] = idx;
+    ++q.queuedTail;
+}
+
+#endif // __linux__
+
+// the request as a blocking call, the fallback when there is no ring
+static int64_t RunBlocking(IoRequest const& r) {
+    int64_t res;
+#ifdef _WIN32
+    if (r.op == IO_SYNC) {
+        res = _commit(r.fd);
+    }
+    else if (_lseeki64(r.fd, r.offset, SEEK_SET) < 0) {
+        res = -1;
+    }
+    else {
+        unsigned n = r.n > 0x7FFFFFFF ? 0x7FFFFFFF : (unsigned) r.n;
+        res = r.op == IO_READ ? _read(r.fd, r.buff, n) : _write(r.fd, r.buff, n);
+    }
+#else
+    do {
+        if (r.op == IO_READ) res = pread(r.fd, r.buff, r.n, r.offset);
+        else if (r.op == IO_WRITE) res = pwrite(r.fd, r.buff, r.n, r.offset);
+#ifdef __APPLE__
+        else res = fsync(r.fd);
+#else
+        else res = fdatasync(r.fd);
+#endif
+    } while (res < 0 && errno == EINTR);
+#endif
+    return res < 0 ? -errno : res;
+}
+
+// true on io_uring, a queue that falls back works all the same
+bool StartIo(IoQueue& q) {
+    q.queued.clear();
+    q.done.clear();
+    q.inFlight = 0;
+#ifdef __linux__
+    return StartRing(q);
+#else
+    return false;
+#endif
+}
+
+// false if IO_QUEUE_DEPTH requests are in flight already, one has to be
+// picked up first
+// buff has to stay valid until the request completes
+bool QueueIo(IoQueue& q, IoRequest const& r) {
+    if (q.inFlight >= IO_QUEUE_DEPTH) return false;
+    ++q.inFlight;
+#ifdef __linux__
+    if (q.ring >= 0) {
+        QueueRing(q, r);
+        return true;
+    }
+#endif
+    q.queued.push_back(r);
+    return true;
+}
+
+// hands everything queued over in one go, returns how many were taken, or
+// -errno
+// the kernel may take fewer, on -EAGAIN or -EBUSY none, the rest stay in the
+// ring and go with the next submit, WaitIo hands them over too
+int SubmitIo(IoQueue& q) {
+#ifdef __linux__
+    if (q.ring >= 0) {
+        unsigned n = q.queuedTail - __atomic_load_n(q.sqHead, __ATOMIC_ACQUIRE);
+        if (n == 0) return 0;
+        __atomic_store_n(q.sqTail, q.queuedTail, __ATOMIC_RELEASE);
+        int res;
+        do res = RingEnter(q.ring, n, 0, 0);
+        while (res < 0 && errno == EINTR);
+        return res < 0 ? -errno : res;
+    }
+#endif
+    int n = (int) q.queued.size();
+    bool failed = false;
+    for (IoRequest const& r : q.queued) {
+        int64_t res = r.linked && failed ? -ECANCELED : RunBlocking(r);
+        failed = res < 0 || (r.op != IO_SYNC && (size_t) res < r.n);
+        q.done.push_back((IoCompletion) { r.user, res });
+    }
+    q.queued.clear();
+    return n;
+}
+
+// never blocks, false if nothing completed since the last call
+bool PollIo(IoQueue& q, IoCompletion* out) {
+#ifdef __linux__
+    if (q.ring >= 0) {
+        unsigned head = *q.cqHead;
+        if (head == __atomic_load_n(q.cqTail, __ATOMIC_ACQUIRE)) return false;
+        struct io_uring_cqe* cqe = &q.cqes[head & *q.cqMask];
+        out->user = cqe->user_data;
+        out->res = cqe->res;
+        __atomic_store_n(q.cqHead, head + 1, __ATOMIC_RELEASE);
+        --q.inFlight;
+        return true;
+    }
+#endif
+    if (q.done.empty()) return false;
+    *out = q.done.front();
+    q.done.erase(q.done.begin());
+    --q.inFlight;
+    return true;
+}
+
+// blocks until a request queued completes, false if none is in flight, or
+// the ring failed
+bool WaitIo(IoQueue& q, IoCompletion* out) {
+    if (q.inFlight == 0) return false;
+    SubmitIo(q);
+    while (!PollIo(q, out)) {
+#ifdef __linux__
+        if (q.ring < 0) return false;
+        // whatever the kernel didn't take yet goes along, it would never
+        // complete otherwise, a full completion ring is drained by the poll
+        unsigned n = q.queuedTail - __atomic_load_n(q.sqHead, __ATOMIC_ACQUIRE);
+        int res = RingEnter(q.ring, n, 1, IORING_ENTER_GETEVENTS);
+        if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+#else
+        return false;
+#endif
+    }
+    return true;
+}
+
+// requests still in flight are waited for, their buffers may be freed after
+void StopIo(IoQueue& q) {
+    IoCompletion c;
+    while (WaitIo(q, &c)) {}
+#ifdef __linux__
+    if (q.ring >= 0) {
+        munmap(q.sqes, q.entries * sizeof(struct io_uring_sqe));
+        if (q.cqMap != q.sqMap) munmap(q.cqMap, q.cqMapSize);
+        munmap(q.sqMap, q.sqMapSize);
+        close(q.ring);
+    }
+#endif
+    q.ring = -1;
+    q.sqMap = q.cqMap = NULL;
+    q.sqes = NULL;
+    q.cqes = NULL;
+    q.queued.clear();
+    q.done.clear();
+    q.inFlight = 0;
+}
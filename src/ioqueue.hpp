@@ -0,0 +1,66 @@
+#ifndef IOQUEUE_H_
+#define IOQUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// requests a queue keeps going at once at most, enough chunks in flight to
+// keep a slow disk or a network mount busy
+#define IO_QUEUE_DEPTH 8
+
+enum IoOp {
+    IO_READ,
+    IO_WRITE,
+    IO_SYNC, // data only where the platform allows, like SyncFile
+};
+
+struct IoRequest {
+    IoOp op;
+    int fd;
+    char* buff;
+    size_t n;
+    uint64_t offset;
+    uint64_t user; // handed back with the completion
+    bool linked; // only runs if the one queued before it succeeded
+};
+
+struct IoCompletion {
+    uint64_t user;
+    int64_t res; // bytes moved, or -errno
+};
+
+// reads, writes and syncs queued up and handed over together, on io_uring
+// where the kernel has it, one submission for a whole batch
+// elsewhere, or if the ring can't be set up, the batch runs as blocking
+// calls when it is submitted, the completions come out the same
+// one thread per queue
+struct IoQueue {
+    int ring = -1;
+    unsigned entries = 0;
+    // the rings shared with the kernel
+    void* sqMap = NULL;
+    void* cqMap = NULL;
+    size_t sqMapSize = 0, cqMapSize = 0;
+    io_uring_sqe* sqes = NULL;
+    unsigned *sqHead = NULL, *sqTail = NULL, *sqMask = NULL, *sqArray = NULL;
+    unsigned *cqHead = NULL, *cqTail = NULL, *cqMask = NULL;
+    io_uring_cqe* cqes = NULL;
+    unsigned queuedTail = 0; // sqTail once what is queued is submitted
+    // without a ring
+    std::vector<IoRequest> queued;
+    std::vector<IoCompletion> done;
+    size_t inFlight = 0; // queued or submitted, not picked up yet
+};
+
+bool StartIo(IoQueue& q);
+bool QueueIo(IoQueue& q, IoRequest const& r);
+int SubmitIo(IoQueue& q);
+bool PollIo(IoQueue& q, IoCompletion* out);
+bool WaitIo(IoQueue& q, IoCompletion* out);
+void StopIo(IoQueue& q);
+
+#endif // IOQUEUE_H_
@@ -0,0 +1,86 @@
+#include "largefile.hpp"
+
+#include <algorithm>
+
+static void IndexLoop(LargeFile* lf) {
+    const char* data = lf->block->data;
+    size_t size = lf->block->size;
+    std::vector<size_t> newlines;
+    for (size_t off = lf->shown; off < size && !lf->stop; ) {
+        size_t n = std::min(LARGE_FILE_INDEX_CHUNK, size - off);
+        newlines.clear();
+        IndexNewlines(data + off, n, off, newlines);
+        off += n;
+        std::lock_guard<std::mutex> lock(lf->lock);
+        lf->found.insert(lf->found.end(), newlines.begin(), newlines.end());
+        lf->foundEnd = off;
+    }
+}
+
+// false if the file can't be mapped or is smaller than minSize, it should be
+// read as usual then
+bool OpenLargeFile(LargeFile& lf, const char* filename, size_t minSize) {
+    // stamped first, a write in between makes it look changed, not the reverse
+    FileStamp stamp;
+    if (!StampFile(filename, &stamp)) return false;
+    size_t size;
+    const char* data = MapFileReadOnly(filename, &size);
+    if (data == NULL) return false;
+    if (size < minSize) {
+        UnmapFile(data, size);
+        return false;
+    }
+
+    lf.block = std::make_shared<TextBlock>();
+    lf.block->data = (char*) data;
+    lf.block->size = size;
+    lf.block->release = UnmapFile;
+    lf.stamp = stamp;
+    lf.shown = std::min(LARGE_FILE_FIRST_CHUNK, size);
+    IndexNewlines(data, lf.shown, 0, lf.block->newlines);
+    lf.found.clear();
+    lf.foundEnd = lf.shown;
+    lf.stop = false;
+    lf.worker = std::thread(IndexLoop, &lf);
+    return true;
+}
+
+// moves what the worker indexed since the last poll into the block, true if
+// there is more to show, bytes [start, start+n) at the end of the original
+// only called from the thread that owns the text
+bool PollLargeFile(LargeFile& lf, size_t* start, size_t* n) {
+    if (!lf.block) return false;
+    std::lock_guard<std::mutex> lock(lf.lock);
+    if (lf.foundEnd == lf.shown) return false;
+    std::vector<size_t>& newlines = lf.block->newlines;
+    newlines.insert(newlines.end(), lf.found.begin(), lf.found.end());
+    lf.found.clear();
+    *start = lf.shown;
+    *n = lf.foundEnd - lf.shown;
+    lf.shown = lf.foundEnd;
+    return true;
+}
+
+// blocks until the whole file is indexed, the last of it still has to be polled
+void WaitLargeFile(LargeFile& lf) {
+    if (lf.worker.joinable()) lf.worker.join();
+}
+
+// the mapping goes away with the last text that shows it
+void CloseLargeFile(LargeFile& lf) {
+    lf.stop = true;
+    WaitLargeFile(lf);
+    lf.block.reset();
+    lf.found.clear();
+    lf.shown = lf.foundEnd = 0;
+}
+
+// the mapped file was written over in place rather than replaced, or cut short
+// under the mapping, what the text shows of it may have changed with it
+// a file renamed over it leaves the mapping as it was
+bool LargeFileChanged(LargeFile const& lf, const char* filename) {
+    if (!lf.block) return false;
+    if (MappingDamaged(lf.block->data)) return true;
+    FileStamp now;
+    return StampFile(filename, &now) && now.id == lf.stamp.id && !SameStamp(now, lf.stamp);
+}
@@ -0,0 +1,41 @@
+#ifndef LARGEFILE_H_
+#define LARGEFILE_H_
+
+#include "storage.hpp"
+#include "file.hpp"
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// indexed before the file is shown, enough for the first screenful
+#define LARGE_FILE_FIRST_CHUNK ((size_t)256*1024)
+// indexed by the worker at a time
+#define LARGE_FILE_INDEX_CHUNK ((size_t)8*1024*1024)
+
+// a file mapped read-only and shown as it is, nothing is copied so memory
+// costs no more than the page cache
+// finding the newlines is the only pass over the whole file, a worker does it
+// while the start of the file is already up, the text only shows as much of
+// the file as has been indexed
+struct LargeFile {
+    std::shared_ptr<TextBlock> block;
+    FileStamp stamp; // the file as it was mapped
+    size_t shown = 0; // bytes handed to the text so far
+    std::thread worker;
+    std::mutex lock;
+    std::vector<size_t> found; // newlines the worker found since the last poll
+    size_t foundEnd = 0; // the worker indexed everything before this
+    std::atomic<bool> stop{false};
+};
+
+bool OpenLargeFile(LargeFile& lf, const char* filename, size_t minSize);
+bool PollLargeFile(LargeFile& lf, size_t* start, size_t* n);
+void WaitLargeFile(LargeFile& lf);
+void CloseLargeFile(LargeFile& lf);
+bool LargeFileChanged(LargeFile const& lf, const char* filename);
+
+#endif // LARGEFILE_H_
@@ -0,0 +1,348 @@
+#include "linearena.hpp"
+
+#include <assert.h>
+#include <string.h>
+
+static size_t BlockClass(size_t n, bool roundUp) {
+    // smallest class holding n if roundUp, largest class n can hold otherwise
+    size_t k = 0;
+    while ((size_t)(ARENA_MIN_BLOCK << (k+1)) <= n)
+        ++k;
+    if (roundUp && (size_t)(ARENA_MIN_BLOCK << k) < n)
+        ++k;
+    return k;
+}
+
+static uint32_t NewSlab(LineArena& arena, size_t size) {
+    uint32_t i;
+    if (!arena.freeSlabs.empty()) {
+        i = arena.freeSlabs.back();
+        arena.freeSlabs.pop_back();
+    }
+    else {
+        i = (uint32_t) arena.slabs.size();
+        arena.slabs.emplace_back();
+    }
+    arena.slabs[i].resize(size);
+    arena.totalBytes += size;
+    return i;
+}
+
+static ArenaBlock ArenaAlloc(LineArena& arena, size_t n, size_t* cap) {
+    if (n > ARENA_SLAB_SIZE/2) {
+        *cap = n;
+        return (ArenaBlock) { NewSlab(arena, n), 0 };
+    }
+
+    size_t k = BlockClass(n, true);
+    if (!arena.freeBlocks[k].empty()) {
+        ArenaFreeBlock free = arena.freeBlocks[k].back();
+        arena.freeBlocks[k].pop_back();
+        arena.freeBytes -= free.cap;
+        *cap = free.cap;
+        return free.block;
+    }
+
+    if (arena.slabs.empty() || arena.currentUsed + n > ARENA_SLAB_SIZE) {
+        if (!arena.slabs.empty())
+            arena.freeBytes += ARENA_SLAB_SIZE - arena.currentUsed;
+        arena.current = NewSlab(arena, ARENA_SLAB_SIZE);
+        arena.currentUsed = 0;
+    }
+    ArenaBlock block = { arena.current, (uint32_t) arena.currentUsed };
+    arena.currentUsed += n;
+    *cap = n;
+    return block;
+}
+
+static void ArenaFree(LineArena& arena, ArenaBlock block, size_t cap) {
+    if (cap > ARENA_SLAB_SIZE/2) {
+        // only ever allocated as a slab of its own
+        arena.totalBytes -= arena.slabs[block.slab].size();
+        std::vector<char>().swap(arena.slabs[block.slab]);
+        arena.freeSlabs.push_back(block.slab);
+        return;
+    }
+    arena.freeBytes += cap;
+    if (cap >= ARENA_MIN_BLOCK) {
+        arena.freeBlocks[BlockClass(cap, false)].push_back((ArenaFreeBlock) { block, (uint32_t) cap });
+    }
+}
+
+static uint64_t HashBytes(const char* s, size_t n) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    size_t i = 0;
+    for (; i+8 <= n; i += 8) {
+        uint64_t k;
+        memcpy(&k, s+i, 8);
+        h = (h ^ k) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    for (; i < n; ++i)
+        h = (h ^ (unsigned char) s[i]) * 0x100000001B3ull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static const char* EntryBytes(LineArena const& arena, PoolEntry const& e) {
+    return arena.slabs[e.block.slab].data() + e.block.offset;
+}
+
+static void PoolGrow(LineArena& arena) {
+    LinePool& pool = arena.pool;
+    std::vector<uint32_t> old;
+    old.swap(pool.slots);
+    pool.slots.assign(old.empty() ? 1024 : old.size()*2, 0);
+    size_t mask = pool.slots.size()-1;
+    for (uint32_t slot : old) {
+        if (slot == 0) continue;
+        size_t i = pool.entries[slot-1].hash & mask;
+        while (pool.slots[i] != 0)
+            i = (i+1) & mask;
+        pool.slots[i] = slot;
+    }
+}
+
+// returns a referenced entry holding s, adding one if there is none yet
+static uint32_t PoolAcquire(LineArena& arena, const char* s, size_t n) {
+    LinePool& pool = arena.pool;
+    if ((pool.used+1)*4 > pool.slots.size()*3)
+        PoolGrow(arena);
+    uint64_t hash = HashBytes(s, n);
+    size_t mask = pool.slots.size()-1;
+    size_t i = hash & mask;
+    for (; pool.slots[i] != 0; i = (i+1) & mask) {
+        PoolEntry& e = pool.entries[pool.slots[i]-1];
+        if (e.hash == hash && e.size == n && memcmp(EntryBytes(arena, e), s, n) == 0) {
+            ++e.refs;
+            return pool.slots[i]-1;
+        }
+    }
+
+    uint32_t id;
+    if (!pool.freeEntries.empty()) {
+        id = pool.freeEntries.back();
+        pool.freeEntries.pop_back();
+    }
+    else {
+        id = (uint32_t) pool.entries.size();
+        pool.entries.emplace_back();
+    }
+    size_t cap;
+    ArenaBlock block = ArenaAlloc(arena, n, &cap);
+    memcpy(arena.slabs[block.slab].data() + block.offset, s, n);
+    pool.entries[id] = (PoolEntry) { hash, n, cap, 1, block };
+    pool.slots[i] = id+1;
+    ++pool.used;
+    return id;
+}
+
+static void PoolRelease(LineArena& arena, uint32_t id) {
+    LinePool& pool = arena.pool;
+    PoolEntry& e = pool.entries[id];
+    if (--e.refs > 0) return;
+    ArenaFree(arena, e.block, e.cap);
+    pool.freeEntries.push_back(id);
+    --pool.used;
+
+    // backward shift deletion keeps every probe sequence unbroken
+    size_t mask = pool.slots.size()-1;
+    size_t i = e.hash & mask;
+    while (pool.slots[i] != id+1)
+        i = (i+1) & mask;
+    for (size_t j = (i+1) & mask; pool.slots[j] != 0; j = (j+1) & mask) {
+        size_t home = pool.entries[pool.slots[j]-1].hash & mask;
+        // move j into the hole at i unless its home lies cyclically in (i, j]
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            pool.slots[i] = pool.slots[j];
+            i = j;
+        }
+    }
+    pool.slots[i] = 0;
+}
+
+static char* WritableBytes(LineArena& arena, PackedLine& line) {
+    assert(line.cap != LINE_BORROWED && line.cap != LINE_INTERNED);
+    if (line.cap == 0)
+        return line.bytes;
+    return arena.slabs[line.block.slab].data() + line.block.offset;
+}
+
+// drops whatever line currently holds, leaving it empty and inline
+static void LineRelease(LineArena& arena, PackedLine& line) {
+    if (line.cap == LINE_BORROWED)
+        arena.originLive -= line.size;
+    else if (line.cap == LINE_INTERNED)
+        PoolRelease(arena, line.entry);
+    else if (line.cap != 0)
+        ArenaFree(arena, line.block, line.cap);
+    line.size = 0;
+    line.cap = 0;
+}
+
+const char* LineBytes(LineArena const& arena, PackedLine const& line) {
+    if (line.cap == 0)
+        return line.bytes;
+    if (line.cap == LINE_BORROWED)
+        return line.borrowed;
+    if (line.cap == LINE_INTERNED)
+        return EntryBytes(arena, arena.pool.entries[line.entry]);
+    return arena.slabs[line.block.slab].data() + line.block.offset;
+}
+
+// s must point into arena.origin
+void LineBorrow(LineArena& arena, PackedLine& line, const char* s, size_t n) {
+    LineRelease(arena, line);
+    if (n == 0) return;
+    line.size = n;
+    line.cap = LINE_BORROWED;
+    line.borrowed = s;
+    arena.originLive += n;
+}
+
+// lines too short to be worth sharing are stored inline instead
+void LineIntern(LineArena& arena, PackedLine& line, const char* s, size_t n) {
+    if (n <= LINE_INLINE_CAP) {
+        char bytes[LINE_INLINE_CAP];
+        memcpy(bytes, s, n);
+        LineRelease(arena, line);
+        memcpy(line.bytes, bytes, n);
+        line.size = n;
+        return;
+    }
+    // s may point into line itself, so release it only afterwards
+    uint32_t id = PoolAcquire(arena, s, n);
+    LineRelease(arena, line);
+    line.size = n;
+    line.cap = LINE_INTERNED;
+    line.entry = id;
+}
+
+// interned lines of the same pool are equal exactly when they share an entry
+bool LinesEqual(LineArena const& a, PackedLine const& x, LineArena const& b, PackedLine const& y) {
+    if (x.size != y.size) return false;
+    if (x.cap == LINE_INTERNED && y.cap == LINE_INTERNED) {
+        PoolEntry const& ex = a.pool.entries[x.entry];
+        PoolEntry const& ey = b.pool.entries[y.entry];
+        if (&a == &b) return x.entry == y.entry;
+        if (ex.hash != ey.hash) return false;
+    }
+    return memcmp(LineBytes(a, x), LineBytes(b, y), x.size) == 0;
+}
+
+void LineInsert(LineArena& arena, PackedLine& line, size_t col, const char* s, size_t n) {
+    if (n == 0) return;
+    size_t size = line.size + n;
+    bool readOnly = line.cap == LINE_BORROWED || line.cap == LINE_INTERNED;
+    size_t cap = line.cap == 0 ? LINE_INLINE_CAP : readOnly ? line.size : line.cap;
+    if (size <= cap) {
+        char* p = WritableBytes(arena, line);
+        memmove(p + col + n, p + col, line.size - col);
+        memcpy(p + col, s, n);
+        line.size = size;
+        return;
+    }
+
+    // lines that already grew once are likely to grow again
+    size_t want = line.cap == 0 || readOnly ? size : line.cap + line.cap/2;
+    if (want < size) want = size;
+    size_t newCap;
+    ArenaBlock block = ArenaAlloc(arena, want, &newCap);
+    char* p = arena.slabs[block.slab].data() + block.offset;
+    const char* old = LineBytes(arena, line);
+    memcpy(p, old, col);
+    memcpy(p + col, s, n);
+    memcpy(p + col + n, old + col, line.size - col);
+    LineRelease(arena, line);
+    line.cap = newCap;
+    line.block = block;
+    line.size = size;
+}
+
+void LineErase(LineArena& arena, PackedLine& line, size_t begin, size_t end) {
+    if (begin == end) return;
+    size_t size = line.size - (end - begin);
+    if (line.cap == LINE_BORROWED && (begin == 0 || end == line.size)) {
+        // still one contiguous span of the origin
+        arena.originLive -= end - begin;
+        if (begin == 0)
+            line.borrowed += end;
+        line.size = size;
+        if (size == 0)
+            line.cap = 0;
+        return;
+    }
+    if (line.cap == LINE_BORROWED || line.cap == LINE_INTERNED) {
+        PackedLine copy = {};
+        if (size > LINE_INLINE_CAP) {
+            size_t cap;
+            copy.block = ArenaAlloc(arena, size, &cap);
+            copy.cap = cap;
+        }
+        const char* old = LineBytes(arena, line);
+        char* p = WritableBytes(arena, copy);
+        memcpy(p, old, begin);
+        memcpy(p + begin, old + end, size - begin);
+        copy.size = size;
+        LineRelease(arena, line);
+        line = copy;
+        return;
+    }
+    char* p = WritableBytes(arena, line);
+    memmove(p + begin, p + end, line.size - end);
+    line.size = size;
+}
+
+void LineFree(LineArena& arena, PackedLine& line) {
+    LineRelease(arena, line);
+}
+
+static bool OriginMostlyDead(LineArena const& arena) {
+    return arena.origin
+        && arena.origin->size - arena.originLive > ARENA_SLAB_SIZE
+        && arena.originLive*2 < arena.origin->size;
+}
+
+bool ArenaNeedsCompaction(LineArena const& arena) {
+    return (arena.freeBytes > ARENA_SLAB_SIZE && arena.freeBytes*3 > arena.totalBytes)
+        || OriginMostlyDead(arena);
+}
+
+// repacks every line tightly and in order into a fresh arena
+// borrowed lines stay borrowed unless most of the origin is dead
+void CompactLines(LineArena& arena, PackedLine* lines, size_t n) {
+    LineArena packed = {};
+    bool keepOrigin = arena.origin && !OriginMostlyDead(arena);
+    if (keepOrigin) {
+        packed.origin = arena.origin;
+        packed.originLive = arena.originLive;
+    }
+    // entries keep their index, so interned lines need no update
+    packed.pool = std::move(arena.pool);
+    for (PoolEntry& e : packed.pool.entries) {
+        if (e.refs == 0) continue;
+        const char* old = EntryBytes(arena, e);
+        e.block = ArenaAlloc(packed, e.size, &e.cap);
+        memcpy(packed.slabs[e.block.slab].data() + e.block.offset, old, e.size);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        PackedLine& line = lines[i];
+        if (line.cap == 0 || line.cap == LINE_INTERNED) continue;
+        if (line.cap == LINE_BORROWED && keepOrigin) continue;
+        const char* old = LineBytes(arena, line);
+        if (line.size <= LINE_INLINE_CAP) {
+            memcpy(line.bytes, old, line.size);
+            line.cap = 0;
+            continue;
+        }
+        size_t cap;
+        ArenaBlock block = ArenaAlloc(packed, line.size, &cap);
+        memcpy(packed.slabs[block.slab].data() + block.offset, old, line.size);
+        line.block = block;
+        line.cap = cap;
+    }
+    arena = std::move(packed);
+}
@@ -0,0 +1,85 @@
+#ifndef LINEARENA_H_
+#define LINEARENA_H_
+
+#include "storage.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#define ARENA_SLAB_SIZE (1024*1024)
+#define ARENA_MIN_BLOCK 32
+#define ARENA_NUM_CLASSES 15 // ARENA_MIN_BLOCK << 14 == ARENA_SLAB_SIZE/2
+#define LINE_INLINE_CAP 16
+#define LINE_BORROWED SIZE_MAX
+#define LINE_INTERNED (SIZE_MAX-1)
+
+struct ArenaBlock {
+    uint32_t slab, offset;
+};
+
+struct ArenaFreeBlock {
+    ArenaBlock block;
+    uint32_t cap;
+};
+
+// one copy of a line shared by every identical interned line
+struct PoolEntry {
+    uint64_t hash;
+    size_t size, cap;
+    uint32_t refs; // 0 while the entry is free
+    ArenaBlock block;
+};
+
+// content addressed, open addressing with linear probing
+struct LinePool {
+    std::vector<PoolEntry> entries;
+    std::vector<uint32_t> freeEntries;
+    std::vector<uint32_t> slots; // entry index + 1, 0 if empty
+    size_t used = 0;
+};
+
+// line bytes are packed into large slabs instead of one malloc per line
+// blocks bigger than half a slab get a slab of their own
+// freed blocks go to power of two free lists, once too much is free the
+// owner compacts, which also puts lines back in document order
+// lines of a loaded file borrow their bytes from the adopted origin block
+// until they are edited, once most of it is dead compaction copies the rest out
+struct LineArena {
+    std::vector<std::vector<char>> slabs;
+    std::vector<ArenaFreeBlock> freeBlocks[ARENA_NUM_CLASSES];
+    std::vector<uint32_t> freeSlabs;
+    uint32_t current = 0;
+    size_t currentUsed = 0;
+    size_t totalBytes = 0, freeBytes = 0;
+    std::shared_ptr<const TextBlock> origin;
+    size_t originLive = 0; // bytes of origin still borrowed
+    LinePool pool;
+};
+
+// short lines are stored inline, longer ones in a LineArena
+// borrowed and interned lines are read-only, they get copied into the arena
+// when edited
+struct PackedLine {
+    size_t size, cap; // cap is 0 while inline, else LINE_BORROWED or LINE_INTERNED if so
+    union {
+        char bytes[LINE_INLINE_CAP];
+        ArenaBlock block;
+        const char* borrowed;
+        uint32_t entry; // in arena.pool
+    };
+};
+
+const char* LineBytes(LineArena const& arena, PackedLine const& line);
+void LineBorrow(LineArena& arena, PackedLine& line, const char* s, size_t n);
+void LineIntern(LineArena& arena, PackedLine& line, const char* s, size_t n);
+bool LinesEqual(LineArena const& a, PackedLine const& x, LineArena const& b, PackedLine const& y);
+void LineInsert(LineArena& arena, PackedLine& line, size_t col, const char* s, size_t n);
+void LineErase(LineArena& arena, PackedLine& line, size_t begin, size_t end);
+void LineFree(LineArena& arena, PackedLine& line);
+
+bool ArenaNeedsCompaction(LineArena const& arena);
+void CompactLines(LineArena& arena, PackedLine* lines, size_t n);
+
+#endif // LINEARENA_H_
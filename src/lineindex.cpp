@@ -0,0 +1,199 @@
+#include "lineindex.hpp"
+
+#include <assert.h>
+
+static uint32_t NextPriority(LineIndex& index) {
+    // xorshift32
+    index.seed ^= index.seed << 13;
+    index.seed ^= index.seed >> 17;
+    index.seed ^= index.seed << 5;
+    return index.seed;
+}
+
+static void Update(LineIndex& index, uint32_t x) {
+    IndexNode& node = index.nodes[x];
+    IndexNode const& l = index.nodes[node.left];
+    IndexNode const& r = index.nodes[node.right];
+    node.lines = l.lines + 1 + r.lines;
+    node.sumLen = l.sumLen + node.len + r.sumLen;
+}
+
+static uint32_t NewNode(LineIndex& index, size_t len) {
+    uint32_t x;
+    if (!index.freeNodes.empty()) {
+        x = index.freeNodes.back();
+        index.freeNodes.pop_back();
+    }
+    else {
+        x = (uint32_t) index.nodes.size();
+        index.nodes.emplace_back();
+    }
+    IndexNode& node = index.nodes[x];
+    node.left = node.right = 0;
+    node.priority = NextPriority(index);
+    node.len = len;
+    node.lines = 1;
+    node.sumLen = len;
+    return x;
+}
+
+static void FreeNodes(LineIndex& index, uint32_t x) {
+    if (x == 0) return;
+    FreeNodes(index, index.nodes[x].left);
+    FreeNodes(index, index.nodes[x].right);
+    index.freeNodes.push_back(x);
+}
+
+// l receives the first n lines of x, r receives the rest
+static void Split(LineIndex& index, uint32_t x, size_t n, uint32_t* l, uint32_t* r) {
+    if (x == 0) {
+        *l = *r = 0;
+        return;
+    }
+    size_t leftLines = index.nodes[index.nodes[x].left].lines;
+    if (n <= leftLines) {
+        uint32_t ll, lr;
+        Split(index, index.nodes[x].left, n, &ll, &lr);
+        index.nodes[x].left = lr;
+        Update(index, x);
+        *l = ll;
+        *r = x;
+    }
+    else {
+        uint32_t rl, rr;
+        Split(index, index.nodes[x].right, n - leftLines - 1, &rl, &rr);
+        index.nodes[x].right = rl;
+        Update(index, x);
+        *l = x;
+        *r = rr;
+    }
+}
+
+static uint32_t Merge(LineIndex& index, uint32_t a, uint32_t b) {
+    if (a == 0) return b;
+    if (b == 0) return a;
+    if (index.nodes[a].priority > index.nodes[b].priority) {
+        uint32_t m = Merge(index, index.nodes[a].right, b);
+        index.nodes[a].right = m;
+        Update(index, a);
+        return a;
+    }
+    uint32_t m = Merge(index, a, index.nodes[b].left);
+    index.nodes[b].left = m;
+    Update(index, b);
+    return b;
+}
+
+// appending builds the tree in O(n) as a Cartesian tree: the right spine is
+// kept on a stack, a node popped off it is final and gets its totals
+void IndexAppendLine(LineIndex& index, size_t size) {
+    std::vector<uint32_t>& spine = index.spine;
+    if (spine.empty()) {
+        for (uint32_t x = index.root; x != 0; x = index.nodes[x].right)
+            spine.push_back(x);
+    }
+    uint32_t x = NewNode(index, size+1);
+    uint32_t last = 0;
+    while (!spine.empty() && index.nodes[spine.back()].priority < index.nodes[x].priority) {
+        last = spine.back();
+        spine.pop_back();
+        Update(index, last);
+    }
+    index.nodes[x].left = last;
+    if (!spine.empty())
+        index.nodes[spine.back()].right = x;
+    spine.push_back(x);
+}
+
+// must follow the last IndexAppendLine before the index is used
+void IndexFinishLines(LineIndex& index) {
+    std::vector<uint32_t>& spine = index.spine;
+    if (spine.empty()) return;
+    for (size_t i = spine.size(); i-- > 0; )
+        Update(index, spine[i]);
+    index.root = spine[0];
+    spine.clear();
+}
+
+static void SetLine(LineIndex& index, uint32_t x, size_t ln, size_t len) {
+    size_t leftLines = index.nodes[index.nodes[x].left].lines;
+    if (ln < leftLines)
+        SetLine(index, index.nodes[x].left, ln, len);
+    else if (ln > leftLines)
+        SetLine(index, index.nodes[x].right, ln - leftLines - 1, len);
+    else
+        index.nodes[x].len = len;
+    Update(index, x);
+}
+
+void IndexSetLine(LineIndex& index, size_t ln, size_t size) {
+    assert(index.spine.empty() && ln < IndexLines(index));
+    SetLine(index, index.root, ln, size+1);
+}
+
+// n empty lines before ln
+void IndexInsertLines(LineIndex& index, size_t ln, size_t n) {
+    assert(index.spine.empty() && ln <= IndexLines(index));
+    if (n == 0) return;
+    uint32_t l, r;
+    Split(index, index.root, ln, &l, &r);
+    index.root = 0;
+    for (size_t i = 0; i < n; ++i)
+        IndexAppendLine(index, 0);
+    IndexFinishLines(index);
+    index.root = Merge(index, Merge(index, l, index.root), r);
+}
+
+void IndexEraseLines(LineIndex& index, size_t ln, size_t n) {
+    assert(index.spine.empty() && ln+n <= IndexLines(index));
+    if (n == 0) return;
+    uint32_t l, m, r;
+    Split(index, index.root, ln, &l, &r);
+    Split(index, r, n, &m, &r);
+    FreeNodes(index, m);
+    index.root = Merge(index, l, r);
+}
+
+size_t IndexOffset(LineIndex const& index, CursorPos pos) {
+    assert(index.spine.empty() && pos.ln < IndexLines(index));
+    size_t off = pos.col;
+    size_t ln = pos.ln;
+    uint32_t x = index.root;
+    while (x != 0) {
+        IndexNode const& node = index.nodes[x];
+        IndexNode const& left = index.nodes[node.left];
+        if (ln < left.lines) {
+            x = node.left;
+        }
+        else {
+            off += left.sumLen;
+            if (ln == left.lines) break;
+            off += node.len;
+            ln -= left.lines + 1;
+            x = node.right;
+        }
+    }
+    return off;
+}
+
+// the line offset falls in, its '\n' counts as part of it
+CursorPos IndexPosition(LineIndex const& index, size_t offset) {
+    assert(index.spine.empty() && offset <= IndexBytes(index));
+    size_t ln = 0;
+    uint32_t x = index.root;
+    while (x != 0) {
+        IndexNode const& node = index.nodes[x];
+        IndexNode const& left = index.nodes[node.left];
+        if (offset < left.sumLen) {
+            x = node.left;
+            continue;
+        }
+        offset -= left.sumLen;
+        ln += left.lines;
+        if (offset < node.len) break;
+        offset -= node.len;
+        ++ln;
+        x = node.right;
+    }
+    return (CursorPos) { ln, offset };
+}
@@ -0,0 +1,40 @@
+#ifndef LINEINDEX_H_
+#define LINEINDEX_H_
+
+#include "storage.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct IndexNode {
+    uint32_t left, right;
+    uint32_t priority;
+    size_t len; // size of the line plus one for its '\n'
+    // totals of the subtree rooted at this node
+    size_t lines, sumLen;
+};
+
+// line sizes for backends that store lines without any byte counts of their
+// own, kept in a treap ordered by line number like the pieces of a PieceTable
+// resizing, inserting or erasing lines and both lookups are all O(log n)
+struct LineIndex {
+    std::vector<IndexNode> nodes = std::vector<IndexNode>(1); // nodes[0] is null
+    std::vector<uint32_t> freeNodes;
+    uint32_t root = 0;
+    uint32_t seed = 0x9E3779B9;
+    std::vector<uint32_t> spine; // right spine while appending, see IndexAppendLine
+};
+
+void IndexAppendLine(LineIndex& index, size_t size);
+void IndexFinishLines(LineIndex& index);
+void IndexSetLine(LineIndex& index, size_t ln, size_t size);
+void IndexInsertLines(LineIndex& index, size_t ln, size_t n);
+void IndexEraseLines(LineIndex& index, size_t ln, size_t n);
+
+size_t IndexOffset(LineIndex const& index, CursorPos pos);
+CursorPos IndexPosition(LineIndex const& index, size_t offset);
+inline size_t IndexLines(LineIndex const& index) { return index.nodes[index.root].lines; }
+inline size_t IndexBytes(LineIndex const& index) { return index.nodes[index.root].sumLen - 1; }
+
+#endif // LINEINDEX_H_
@@ -0,0 +1,251 @@
+#include "linevector.hpp"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GAP_MIN 64
+
+static void HeatLine(LineVector& text, size_t ln) {
+    if (text.hotLn == ln) return;
+    FlushHotLine(text);
+    GapBuffer& hot = text.hot;
+    PackedLine& line = text.lines[ln];
+    const char* p = LineBytes(text.arena, line);
+    hot.buff.assign(p, p + line.size);
+    hot.gapBegin = hot.buff.size();
+    hot.buff.resize(hot.buff.size() + GAP_MIN + hot.buff.size()/2);
+    hot.gapEnd = hot.buff.size();
+    LineFree(text.arena, line);
+    text.hotLn = ln;
+}
+
+static void MaybeCompact(LineVector& text) {
+    if (ArenaNeedsCompaction(text.arena))
+        CompactLines(text.arena, text.lines.data(), text.lines.size());
+}
+
+static void MoveGap(GapBuffer& hot, size_t col) {
+    char* p = hot.buff.data();
+    if (col < hot.gapBegin) {
+        size_t n = hot.gapBegin - col;
+        memmove(p + hot.gapEnd - n, p + col, n);
+        hot.gapBegin -= n;
+        hot.gapEnd -= n;
+    }
+    else if (col > hot.gapBegin) {
+        size_t n = col - hot.gapBegin;
+        memmove(p + hot.gapBegin, p + hot.gapEnd, n);
+        hot.gapBegin += n;
+        hot.gapEnd += n;
+    }
+}
+
+static void GapInsert(GapBuffer& hot, size_t col, const char* s, size_t n) {
+    MoveGap(hot, col);
+    if (hot.gapEnd - hot.gapBegin < n) {
+        size_t backSize = hot.buff.size() - hot.gapEnd;
+        size_t newSize = (hot.gapBegin + n + backSize) * 2 + GAP_MIN;
+        hot.buff.resize(newSize);
+        char* p = hot.buff.data();
+        memmove(p + newSize - backSize, p + hot.gapEnd, backSize);
+        hot.gapEnd = newSize - backSize;
+    }
+    memcpy(hot.buff.data() + hot.gapBegin, s, n);
+    hot.gapBegin += n;
+}
+
+static void GapErase(GapBuffer& hot, size_t begin, size_t end) {
+    MoveGap(hot, begin);
+    hot.gapEnd += end - begin;
+}
+
+// moves the hot line back into the arena
+void FlushHotLine(LineVector& text) {
+    if (text.hotLn == SIZE_MAX) return;
+    GapBuffer& hot = text.hot;
+    PackedLine& line = text.lines[text.hotLn];
+    if (text.internLines) {
+        size_t size = hot.buff.size() - (hot.gapEnd - hot.gapBegin);
+        MoveGap(hot, size);
+        LineIntern(text.arena, line, hot.buff.data(), size);
+    }
+    else {
+        LineInsert(text.arena, line, 0, hot.buff.data(), hot.gapBegin);
+        LineInsert(text.arena, line, line.size, hot.buff.data() + hot.gapEnd, hot.buff.size() - hot.gapEnd);
+    }
+    hot.buff.clear();
+    text.hotLn = SIZE_MAX;
+}
+
+bool LinesEqual(LineVector const& a, size_t lnA, LineVector const& b, size_t lnB) {
+    if (lnA == a.hotLn || lnB == b.hotLn) {
+        LineVectorLine x = a[lnA], y = b[lnB];
+        if (x.size() != y.size()) return false;
+        for (size_t i = 0; i < x.size(); ++i) {
+            if (x[i] != y[i]) return false;
+        }
+        return true;
+    }
+    return LinesEqual(a.arena, a.lines[lnA], b.arena, b.lines[lnB]);
+}
+
+static void InternLine(LineVector& text, size_t ln) {
+    PackedLine& line = text.lines[ln];
+    if (line.cap != LINE_INTERNED && line.cap != 0)
+        LineIntern(text.arena, line, LineBytes(text.arena, line), line.size);
+}
+
+// takes ownership of buff, lines borrow their bytes from it in place unless
+// they are interned
+void LoadText(LineVector& text, char* buff, size_t n) {
+    text.version = NextTextVersion();
+    text.hotLn = SIZE_MAX;
+    text.hot.buff.clear();
+    text.arena = LineArena{};
+    text.index = LineIndex{};
+
+    std::shared_ptr<TextBlock> block = AdoptTextBlock(buff, n);
+    std::vector<size_t> const& newlines = block->newlines;
+    text.lines.assign(newlines.size() + 1, PackedLine{});
+    size_t begin = 0;
+    for (size_t i = 0; i <= newlines.size(); ++i) {
+        size_t end = i < newlines.size() ? newlines[i] : n;
+        if (text.internLines)
+            LineIntern(text.arena, text.lines[i], buff+begin, end-begin);
+        else
+            LineBorrow(text.arena, text.lines[i], buff+begin, end-begin);
+        IndexAppendLine(text.index, end-begin);
+        begin = end+1;
+    }
+    IndexFinishLines(text.index);
+    // the lines are the index from now on
+    std::vector<size_t>().swap(block->newlines);
+    if (!text.internLines)
+        text.arena.origin = std::move(block);
+}
+
+void InsertCStr(LineVector& text, CursorPos& curPos, const char* s, size_t n) {
+    text.version = NextTextVersion();
+    // assumes s is 'clean'
+    if (memchr(s, '\n', n) == NULL) {
+        HeatLine(text, curPos.ln);
+        GapInsert(text.hot, curPos.col, s, n);
+        IndexSetLine(text.index, curPos.ln, text[curPos.ln].size());
+        curPos.col += n;
+        return;
+    }
+    FlushHotLine(text);
+
+    std::vector<PackedLine>& lines = text.lines;
+    LineArena& arena = text.arena;
+    std::vector<size_t> lineIdx;
+    for (size_t i = 0; i < n; ++i) {
+        if (s[i] == '\n') {
+            // FIXME: lazy dynamic array, no error checking
+            lineIdx.push_back(i);
+        }
+    }
+    size_t nLines = lineIdx.size();
+    lineIdx.push_back(n);
+
+    size_t firstLn = curPos.ln;
+    if (nLines > 0) {
+        // split line
+        lines.insert(lines.begin()+curPos.ln+1, nLines, PackedLine{});
+        IndexInsertLines(text.index, curPos.ln+1, nLines);
+        PackedLine& line = lines[curPos.ln];
+        LineInsert(arena, lines[curPos.ln+nLines], 0,
+            LineBytes(arena, line)+curPos.col,
+            line.size-curPos.col);
+        LineErase(arena, line, curPos.col, line.size);
+    }
+    LineInsert(arena, lines[curPos.ln], curPos.col, s, lineIdx[0]);
+    curPos.col += lineIdx[0];
+    for (size_t i = 0; i < nLines; ++i) {
+        size_t sz = lineIdx[i+1]-lineIdx[i]-1;
+        ++curPos.ln;
+        LineInsert(arena, lines[curPos.ln], 0, s+lineIdx[i]+1, sz);
+        curPos.col = sz;
+    }
+    for (size_t ln = firstLn; ln <= curPos.ln; ++ln) {
+        IndexSetLine(text.index, ln, lines[ln].size);
+        if (text.internLines)
+            InternLine(text, ln);
+    }
+    MaybeCompact(text);
+}
+
+void EraseBetween(LineVector& text, CursorPos begin, CursorPos end) {
+    text.version = NextTextVersion();
+    if (begin.ln == end.ln) {
+        HeatLine(text, begin.ln);
+        GapErase(text.hot, begin.col, end.col);
+        IndexSetLine(text.index, begin.ln, text[begin.ln].size());
+    }
+    else {
+        assert(end.ln > begin.ln);
+        FlushHotLine(text);
+        std::vector<PackedLine>& lines = text.lines;
+        LineArena& arena = text.arena;
+        PackedLine& first = lines[begin.ln];
+        PackedLine& last = lines[end.ln];
+        LineErase(arena, first, begin.col, first.size);
+        LineInsert(arena, first, first.size, LineBytes(arena, last)+end.col, last.size-end.col);
+        for (size_t ln = begin.ln+1; ln <= end.ln; ++ln)
+            LineFree(arena, lines[ln]);
+        lines.erase(lines.begin()+begin.ln+1, lines.begin()+end.ln+1);
+        IndexEraseLines(text.index, begin.ln+1, end.ln-begin.ln);
+        IndexSetLine(text.index, begin.ln, first.size);
+        if (text.internLines)
+            InternLine(text, begin.ln);
+        MaybeCompact(text);
+    }
+}
+
+size_t CountBetween(LineVector const& text, CursorPos begin, CursorPos end) {
+    return PosToOffset(text, end) - PosToOffset(text, begin);
+}
+
+size_t PosToOffset(LineVector const& text, CursorPos pos) {
+    return IndexOffset(text.index, pos);
+}
+
+CursorPos OffsetToPos(LineVector const& text, size_t offset) {
+    return IndexPosition(text.index, offset);
+}
+
+size_t TextBytes(LineVector const& text) {
+    return IndexBytes(text.index);
+}
+
+static char* CopyLine(LineVectorLine const& line, size_t begin, size_t end, char* out) {
+    if (begin < line.frontSize) {
+        size_t n = (end < line.frontSize ? end : line.frontSize) - begin;
+        memcpy(out, line.front + begin, n);
+        out += n;
+    }
+    if (end > line.frontSize) {
+        size_t b = begin > line.frontSize ? begin - line.frontSize : 0;
+        size_t n = end - line.frontSize - b;
+        memcpy(out, line.back + b, n);
+        out += n;
+    }
+    return out;
+}
+
+void CopyBetween(LineVector const& text, CursorPos begin, CursorPos end, char* out) {
+    if (begin.ln == end.ln) {
+        CopyLine(text[begin.ln], begin.col, end.col, out);
+        return;
+    }
+    out = CopyLine(text[begin.ln], begin.col, text[begin.ln].size(), out);
+    *out++ = '\n';
+    for (size_t ln = begin.ln+1;
+        ln < end.ln; ++ln)
+    {
+        out = CopyLine(text[ln], 0, text[ln].size(), out);
+        *out++ = '\n';
+    }
+    CopyLine(text[end.ln], 0, end.col, out);
+}
@@ -0,0 +1,70 @@
+#ifndef LINEVECTOR_H_
+#define LINEVECTOR_H_
+
+#include "storage.hpp"
+#include "linearena.hpp"
+#include "lineindex.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+typedef std::vector<char> Line;
+
+// the line being edited is held as a gap buffer, so typing or deleting at the
+// cursor doesn't shift the rest of the line
+struct GapBuffer {
+    std::vector<char> buff;
+    size_t gapBegin, gapEnd;
+};
+
+// a line is at most two spans, the second is only used by the hot line
+struct LineVectorLine {
+    const char* front;
+    size_t frontSize;
+    const char* back;
+    size_t backSize;
+
+    size_t size() const { return frontSize + backSize; }
+    char operator[](size_t col) const {
+        return col < frontSize ? front[col] : back[col-frontSize];
+    }
+};
+
+// a vector of lines whose bytes are packed in an arena
+struct LineVector {
+    std::vector<PackedLine> lines;
+    LineArena arena;
+    // while a line is hot its entry in lines is empty, it is moved back
+    // when an edit touches another line or changes the number of lines
+    size_t hotLn = SIZE_MAX;
+    GapBuffer hot;
+    LineIndex index;
+    // identical lines share one copy, set before LoadText, see InternLines
+    bool internLines = false;
+    uint64_t version = 0; // see NextTextVersion
+
+    size_t size() const { return lines.size(); }
+    LineVectorLine operator[](size_t ln) const {
+        if (ln == hotLn) {
+            return (LineVectorLine) {
+                hot.buff.data(), hot.gapBegin,
+                hot.buff.data() + hot.gapEnd, hot.buff.size() - hot.gapEnd,
+            };
+        }
+        return (LineVectorLine) { LineBytes(arena, lines[ln]), lines[ln].size, NULL, 0 };
+    }
+};
+
+void FlushHotLine(LineVector& text);
+bool LinesEqual(LineVector const& a, size_t lnA, LineVector const& b, size_t lnB);
+
+void LoadText(LineVector& text, char* buff, size_t n);
+void InsertCStr(LineVector& text, CursorPos& curPos, const char* s, size_t n);
+void EraseBetween(LineVector& text, CursorPos begin, CursorPos end);
+size_t CountBetween(LineVector const& text, CursorPos begin, CursorPos end);
+size_t PosToOffset(LineVector const& text, CursorPos pos);
+CursorPos OffsetToPos(LineVector const& text, size_t offset);
+size_t TextBytes(LineVector const& text);
+void CopyBetween(LineVector const& text, CursorPos begin, CursorPos end, char* out);
+
+#endif // LINEVECTOR_H_
@@ -0,0 +1,81 @@
+#include "loader.hpp"
+#include "file.hpp"
+#include "undo.hpp"
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+// on the worker, copies out every chunk as it is read, up to LOADER_SHOW_MAX
+static bool Arrived(const char* buff, size_t done, size_t total, void* user) {
+    TextLoader* loader = (TextLoader*) user;
+    std::lock_guard<std::mutex> lock(loader->lock);
+    size_t n = std::min(done - loader->done, LOADER_SHOW_MAX - loader->passed);
+    loader->arrived.insert(loader->arrived.end(), buff + loader->done, buff + loader->done + n);
+    loader->passed += n;
+    loader->done = done;
+    loader->total = total;
+    return !loader->stop;
+}
+
+static void LoadLoop(TextLoader* loader) {
+    char* buff;
+    size_t n;
+    int err = OpenAndReadFile(FilePathRelativeToCWD, loader->filename, &n, &buff, Arrived, loader);
+    if (err == 0) {
+        {
+            // the whole text takes over shortly, what wasn't shown yet won't be
+            std::lock_guard<std::mutex> lock(loader->lock);
+            std::vector<char>().swap(loader->arrived);
+        }
+        n = DecodeText(buff, n, &loader->format);
+        loader->hash = HashText(buff, n);
+        loader->textSize = n;
+        LoadText(loader->text, buff, n);
+    }
+    std::lock_guard<std::mutex> lock(loader->lock);
+    loader->err = err;
+    loader->finished = true;
+}
+
+void StartLoad(TextLoader& loader, const char* filename) {
+    loader.filename = strdup(filename);
+    loader.arrived.clear();
+    loader.passed = 0;
+    loader.done = loader.total = 0;
+    loader.finished = false;
+    loader.err = 0;
+    loader.stop = false;
+    loader.worker = std::thread(LoadLoop, &loader);
+}
+
+// moves up to LOADER_SHOW_CHUNK of what was read since the last poll to out,
+// true once the text is loaded, or failed to
+bool PollLoad(TextLoader& loader, std::vector<char>& out) {
+    std::lock_guard<std::mutex> lock(loader.lock);
+    if (loader.arrived.size() <= LOADER_SHOW_CHUNK) {
+        out.clear();
+        out.swap(loader.arrived);
+    }
+    else {
+        out.assign(loader.arrived.begin(), loader.arrived.begin() + LOADER_SHOW_CHUNK);
+        loader.arrived.erase(loader.arrived.begin(), loader.arrived.begin() + LOADER_SHOW_CHUNK);
+    }
+    if (loader.finished && loader.worker.joinable()) loader.worker.join();
+    return loader.finished;
+}
+
+void LoadProgress(TextLoader& loader, size_t* done, size_t* total) {
+    std::lock_guard<std::mutex> lock(loader.lock);
+    *done = loader.done;
+    *total = loader.total;
+}
+
+// gives up on a load still going, the text is left empty
+void StopLoad(TextLoader& loader) {
+    loader.stop = true;
+    if (loader.worker.joinable()) loader.worker.join();
+    free(loader.filename);
+    loader.filename = NULL;
+    loader.arrived.clear();
+}
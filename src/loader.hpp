@@ -0,0 +1,45 @@
+#ifndef LOADER_H_
+#define LOADER_H_
+
+#include "buffer.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// handed over to be shown per poll at most
+#define LOADER_SHOW_CHUNK ((size_t)4*1024*1024)
+// passed on to be shown while loading at most, the rest only shows once loaded
+// so the copy shown meanwhile stays small next to the text being built
+#define LOADER_SHOW_MAX ((size_t)32*1024*1024)
+
+// a file read and loaded into a text on a worker thread, so the window is up
+// while it loads
+// what has been read is passed on as it comes in, to be shown before the rest,
+// once the whole file is there the text built from it takes over
+struct TextLoader {
+    std::thread worker;
+    std::mutex lock;
+    char* filename = NULL;
+    std::vector<char> arrived; // read but not polled yet, as the file has it
+    size_t passed = 0; // bytes put on arrived so far
+    size_t done = 0, total = 0; // bytes read, and the file size if known
+    bool finished = false;
+    int err = 0; // from OpenAndReadFile
+    std::atomic<bool> stop{false};
+    // set once finished without an error
+    Text text;
+    TextFormat format;
+    uint64_t hash = 0;
+    size_t textSize = 0;
+};
+
+void StartLoad(TextLoader& loader, const char* filename);
+bool PollLoad(TextLoader& loader, std::vector<char>& out);
+void LoadProgress(TextLoader& loader, size_t* done, size_t* total);
+void StopLoad(TextLoader& loader);
+
+#endif // LOADER_H_
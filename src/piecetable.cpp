@@ -0,0 +1,381 @@
+#include "piecetable.hpp"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static std::vector<size_t> const& Newlines(PieceTable const& t, bool added) {
+    return added ? t.addedNewlines : t.original->newlines;
+}
+
+static const char* Source(PieceTable const& t, Piece const& p) {
+    return p.added ? t.added.data() : t.original->data;
+}
+
+static size_t CountNewlines(std::vector<size_t> const& newlines, size_t start, size_t len) {
+    auto b = std::lower_bound(newlines.begin(), newlines.end(), start);
+    auto e = std::lower_bound(b, newlines.end(), start+len);
+    return e - b;
+}
+
+static uint32_t NextPriority(PieceTable& t) {
+    // xorshift32
+    t.seed ^= t.seed << 13;
+    t.seed ^= t.seed >> 17;
+    t.seed ^= t.seed << 5;
+    return t.seed;
+}
+
+static void Update(PieceTable& t, uint32_t x) {
+    Piece& p = t.pieces[x];
+    p.sumLen = t.pieces[p.left].sumLen + p.len + t.pieces[p.right].sumLen;
+    p.sumNewlines = t.pieces[p.left].sumNewlines + p.newlines + t.pieces[p.right].sumNewlines;
+}
+
+static uint32_t NewPiece(PieceTable& t, bool added, size_t start, size_t len, uint32_t priority) {
+    uint32_t x;
+    if (!t.freePieces.empty()) {
+        x = t.freePieces.back();
+        t.freePieces.pop_back();
+    }
+    else {
+        x = (uint32_t) t.pieces.size();
+        t.pieces.emplace_back();
+    }
+    Piece& p = t.pieces[x];
+    p.left = p.right = 0;
+    p.priority = priority;
+    p.added = added;
+    p.start = start;
+    p.len = len;
+    p.newlines = CountNewlines(Newlines(t, added), start, len);
+    Update(t, x);
+    return x;
+}
+
+static void FreePieces(PieceTable& t, uint32_t x) {
+    if (x == 0) return;
+    FreePieces(t, t.pieces[x].left);
+    FreePieces(t, t.pieces[x].right);
+    t.freePieces.push_back(x);
+}
+
+// l receives the first off bytes of x, r receives the rest
+// NOTE: may allocate a piece, don't hold references into t.pieces across calls
+static void Split(PieceTable& t, uint32_t x, size_t off, uint32_t* l, uint32_t* r) {
+    if (x == 0) {
+        *l = *r = 0;
+        return;
+    }
+    size_t leftLen = t.pieces[t.pieces[x].left].sumLen;
+    if (off <= leftLen) {
+        uint32_t ll, lr;
+        Split(t, t.pieces[x].left, off, &ll, &lr);
+        t.pieces[x].left = lr;
+        Update(t, x);
+        *l = ll;
+        *r = x;
+    }
+    else if (off >= leftLen + t.pieces[x].len) {
+        uint32_t rl, rr;
+        Split(t, t.pieces[x].right, off - leftLen - t.pieces[x].len, &rl, &rr);
+        t.pieces[x].right = rl;
+        Update(t, x);
+        *l = x;
+        *r = rr;
+    }
+    else {
+        // cut the piece itself, the second half inherits the priority so that
+        // it can take over the right subtree
+        size_t k = off - leftLen;
+        Piece p = t.pieces[x];
+        uint32_t y = NewPiece(t, p.added, p.start+k, p.len-k, p.priority);
+        t.pieces[y].right = p.right;
+        Update(t, y);
+        t.pieces[x].len = k;
+        t.pieces[x].newlines = p.newlines - t.pieces[y].newlines;
+        t.pieces[x].right = 0;
+        Update(t, x);
+        *l = x;
+        *r = y;
+    }
+}
+
+static uint32_t Merge(PieceTable& t, uint32_t a, uint32_t b) {
+    if (a == 0) return b;
+    if (b == 0) return a;
+    if (t.pieces[a].priority > t.pieces[b].priority) {
+        uint32_t m = Merge(t, t.pieces[a].right, b);
+        t.pieces[a].right = m;
+        Update(t, a);
+        return a;
+    }
+    uint32_t m = Merge(t, a, t.pieces[b].left);
+    t.pieces[b].left = m;
+    Update(t, b);
+    return b;
+}
+
+// consecutive typing inserts right where the last insert ended, in which case
+// the piece at the end of the add buffer can grow instead of splitting the tree
+static bool ExtendPiece(PieceTable& t, uint32_t x, size_t off, size_t addEnd, size_t n, size_t nl) {
+    if (x == 0) return false;
+    Piece& p = t.pieces[x];
+    size_t leftLen = t.pieces[p.left].sumLen;
+    bool found = false;
+    if (off <= leftLen) {
+        found = ExtendPiece(t, p.left, off, addEnd, n, nl);
+    }
+    else if (off > leftLen + p.len) {
+        found = ExtendPiece(t, p.right, off - leftLen - p.len, addEnd, n, nl);
+    }
+    else if (off == leftLen + p.len && p.added && p.start + p.len == addEnd) {
+        p.len += n;
+        p.newlines += nl;
+        found = true;
+    }
+    if (found) {
+        p.sumLen += n;
+        p.sumNewlines += nl;
+    }
+    return found;
+}
+
+// the last piece grows if the original continues right where it ends
+static bool ExtendLastPiece(PieceTable& t, uint32_t x, size_t start, size_t n, size_t nl) {
+    if (x == 0) return false;
+    Piece& p = t.pieces[x];
+    bool found = p.right != 0
+        ? ExtendLastPiece(t, p.right, start, n, nl)
+        : !p.added && p.start + p.len == start;
+    if (found) {
+        if (p.right == 0) {
+            p.len += n;
+            p.newlines += nl;
+        }
+        p.sumLen += n;
+        p.sumNewlines += nl;
+    }
+    return found;
+}
+
+static size_t LineStart(PieceTable const& t, size_t ln) {
+    // offset just past the ln-th newline
+    if (ln == 0) return 0;
+    size_t base = 0, k = ln;
+    uint32_t x = t.root;
+    while (x != 0) {
+        Piece const& p = t.pieces[x];
+        Piece const& left = t.pieces[p.left];
+        if (k <= left.sumNewlines) {
+            x = p.left;
+            continue;
+        }
+        k -= left.sumNewlines;
+        base += left.sumLen;
+        if (k <= p.newlines) {
+            std::vector<size_t> const& newlines = Newlines(t, p.added);
+            size_t i = std::lower_bound(newlines.begin(), newlines.end(), p.start) - newlines.begin();
+            return base + newlines[i+k-1] - p.start + 1;
+        }
+        k -= p.newlines;
+        base += p.len;
+        x = p.right;
+    }
+    assert(0 && "Line out of range");
+    return base;
+}
+
+size_t PosToOffset(PieceTable const& text, CursorPos pos) {
+    return LineStart(text, pos.ln) + pos.col;
+}
+
+CursorPos OffsetToPos(PieceTable const& text, size_t offset) {
+    assert(offset <= TextBytes(text));
+    // count the newlines before offset
+    size_t ln = 0, base = 0;
+    uint32_t x = text.root;
+    while (x != 0) {
+        Piece const& p = text.pieces[x];
+        Piece const& left = text.pieces[p.left];
+        if (offset < base + left.sumLen) {
+            x = p.left;
+            continue;
+        }
+        ln += left.sumNewlines;
+        base += left.sumLen;
+        if (offset < base + p.len) {
+            ln += CountNewlines(Newlines(text, p.added), p.start, offset - base);
+            break;
+        }
+        ln += p.newlines;
+        base += p.len;
+        x = p.right;
+    }
+    return (CursorPos) { ln, offset - LineStart(text, ln) };
+}
+
+size_t TextBytes(PieceTable const& text) {
+    return text.pieces[text.root].sumLen;
+}
+
+PieceTableLine PieceTable::operator[](size_t ln) const {
+    size_t begin = LineStart(*this, ln);
+    size_t end = ln+1 < size() ? LineStart(*this, ln+1)-1 : pieces[root].sumLen;
+    return (PieceTableLine) { this, begin, end-begin, NULL, 0, 0, 0 };
+}
+
+void PieceTableLine::FindChunk(size_t off) const {
+    PieceTable const& t = *table;
+    size_t base = 0;
+    uint32_t x = t.root;
+    while (x != 0) {
+        Piece const& p = t.pieces[x];
+        size_t leftLen = t.pieces[p.left].sumLen;
+        if (off < base + leftLen) {
+            x = p.left;
+        }
+        else if (off < base + leftLen + p.len) {
+            chunkBegin = base + leftLen;
+            chunkEnd = chunkBegin + p.len;
+            if (!p.added && t.cold) {
+                // narrow the chunk down to the frame holding off
+                size_t src = p.start + (off - chunkBegin), frameEnd;
+                const char* raw = ColdBytes(*t.cold, t.coldCache, src, &frameEnd);
+                size_t frameBegin = src - src % COLD_FRAME_SIZE;
+                if (p.start < frameBegin)
+                    chunkBegin += frameBegin - p.start;
+                if (p.start + p.len > frameEnd)
+                    chunkEnd -= p.start + p.len - frameEnd;
+                chunk = raw - (off - chunkBegin);
+                chunkEpoch = t.coldCache.evictions;
+                return;
+            }
+            chunk = Source(t, p) + p.start;
+            return;
+        }
+        else {
+            base += leftLen + p.len;
+            x = p.right;
+        }
+    }
+    assert(0 && "Offset out of range");
+}
+
+// takes ownership of buff, which becomes the original block
+void LoadText(PieceTable& text, char* buff, size_t n) {
+    size_t coldMinSize = text.coldMinSize;
+    text = PieceTable{};
+    text.coldMinSize = coldMinSize;
+    text.version = NextTextVersion();
+    if (n == 0) {
+        free(buff);
+        return;
+    }
+    std::shared_ptr<TextBlock> block = AdoptTextBlock(buff, n);
+    if (n >= coldMinSize) {
+        text.cold = ColdCompress(block->data, n);
+        free(block->data);
+        block->data = NULL;
+    }
+    text.original = std::move(block);
+    text.root = NewPiece(text, false, 0, n, NextPriority(text));
+}
+
+// shares a block someone else owns and may still be indexing, only its first
+// n bytes are shown, more of it through AppendOriginal
+// never compressed, the block is expected to be a mapping already
+void LoadTextBlock(PieceTable& text, std::shared_ptr<const TextBlock> block, size_t n) {
+    size_t coldMinSize = text.coldMinSize;
+    text = PieceTable{};
+    text.coldMinSize = coldMinSize;
+    text.version = NextTextVersion();
+    text.original = std::move(block);
+    if (n > 0) text.root = NewPiece(text, false, 0, n, NextPriority(text));
+}
+
+// shows original bytes [start, start+n) at the end of the document, their
+// newlines must be in the original's index already
+void AppendOriginal(PieceTable& text, size_t start, size_t n) {
+    text.version = NextTextVersion();
+    if (n == 0) return;
+    size_t nl = CountNewlines(text.original->newlines, start, n);
+    if (!ExtendLastPiece(text, text.root, start, n, nl)) {
+        uint32_t x = NewPiece(text, false, start, n, NextPriority(text));
+        text.root = Merge(text, text.root, x);
+    }
+}
+
+void InsertCStr(PieceTable& text, CursorPos& curPos, const char* s, size_t n) {
+    text.version = NextTextVersion();
+    if (n == 0) return;
+    size_t off = PosToOffset(text, curPos);
+    size_t addStart = text.added.size();
+    size_t nlStart = text.addedNewlines.size();
+    text.added.insert(text.added.end(), s, s+n);
+    IndexNewlines(s, n, addStart, text.addedNewlines);
+    size_t nl = text.addedNewlines.size() - nlStart;
+
+    if (!ExtendPiece(text, text.root, off, addStart, n, nl)) {
+        uint32_t l, r;
+        Split(text, text.root, off, &l, &r);
+        uint32_t x = NewPiece(text, true, addStart, n, NextPriority(text));
+        text.root = Merge(text, Merge(text, l, x), r);
+    }
+
+    if (nl > 0) {
+        curPos.ln += nl;
+        curPos.col = addStart + n - text.addedNewlines.back() - 1;
+    }
+    else {
+        curPos.col += n;
+    }
+}
+
+void EraseBetween(PieceTable& text, CursorPos begin, CursorPos end) {
+    text.version = NextTextVersion();
+    size_t b = PosToOffset(text, begin);
+    size_t e = PosToOffset(text, end);
+    assert(b <= e);
+    if (b == e) return;
+    uint32_t l, m, r;
+    Split(text, text.root, e, &m, &r);
+    Split(text, m, b, &l, &m);
+    FreePieces(text, m);
+    text.root = Merge(text, l, r);
+}
+
+size_t CountBetween(PieceTable const& text, CursorPos begin, CursorPos end) {
+    return PosToOffset(text, end) - PosToOffset(text, begin);
+}
+
+static void CopyRange(PieceTable const& t, uint32_t x, size_t base, size_t b, size_t e, char* out) {
+    // base is the document offset of the subtree rooted at x
+    if (x == 0 || e <= base || b >= base + t.pieces[x].sumLen) return;
+    Piece const& p = t.pieces[x];
+    CopyRange(t, p.left, base, b, e, out);
+    size_t pb = base + t.pieces[p.left].sumLen;
+    size_t pe = pb + p.len;
+    size_t lo = pb > b ? pb : b;
+    size_t hi = pe < e ? pe : e;
+    if (lo < hi && !p.added && t.cold) {
+        for (size_t src = p.start + (lo-pb); lo < hi;) {
+            size_t frameEnd;
+            const char* raw = ColdBytes(*t.cold, t.coldCache, src, &frameEnd);
+            size_t n = frameEnd - src < hi - lo ? frameEnd - src : hi - lo;
+            memcpy(out + (lo-b), raw, n);
+            lo += n;
+            src += n;
+        }
+    }
+    else if (lo < hi) {
+        memcpy(out + (lo-b), Source(t, p) + p.start + (lo-pb), hi-lo);
+    }
+    CopyRange(t, p.right, pe, b, e, out);
+}
+
+void CopyBetween(PieceTable const& text, CursorPos begin, CursorPos end, char* out) {
+    CopyRange(text, text.root, 0, PosToOffset(text, begin), PosToOffset(text, end), out);
+}
@@ -0,0 +1,79 @@
+#ifndef PIECETABLE_H_
+#define PIECETABLE_H_
+
+#include "storage.hpp"
+#include "coldstore.hpp"
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+// originals at least this big are kept compressed, see ColdStore
+// below LargeFileMinSize, the editor maps files that big instead of loading them
+#define PIECE_COLD_MIN_SIZE ((size_t)64*1024*1024)
+
+struct Piece {
+    uint32_t left, right;
+    uint32_t priority;
+    bool added; // refers to the add buffer rather than the original block
+    size_t start, len, newlines;
+    // totals of the subtree rooted at this piece
+    size_t sumLen, sumNewlines;
+};
+
+struct PieceTableLine;
+
+// the original file is adopted as a read-only block and never modified,
+// inserted text is appended to the add buffer
+// pieces are kept in a treap ordered by document position, each one caching the
+// length and newline count of its subtree, so finding a line or an offset and
+// splitting or joining pieces are all O(log pieces)
+// a very large original is compressed, its index of newlines is kept as is
+struct PieceTable {
+    std::shared_ptr<const TextBlock> original;
+    std::shared_ptr<const ColdStore> cold; // holds the original bytes if set
+    mutable ColdCache coldCache;
+    size_t coldMinSize = PIECE_COLD_MIN_SIZE;
+    std::vector<char> added;
+    std::vector<size_t> addedNewlines;
+    std::vector<Piece> pieces = std::vector<Piece>(1); // pieces[0] is null
+    std::vector<uint32_t> freePieces;
+    uint32_t root = 0;
+    uint32_t seed = 0x9E3779B9;
+    uint64_t version = 0; // see NextTextVersion
+
+    size_t size() const { return pieces[root].sumNewlines + 1; }
+    PieceTableLine operator[](size_t ln) const;
+};
+
+// lines are not necessarily contiguous, so they are accessed through a view
+// which remembers the last piece it read from
+struct PieceTableLine {
+    PieceTable const* table;
+    size_t begin, len;
+    mutable const char* chunk;
+    mutable size_t chunkBegin, chunkEnd; // document offsets covered by chunk
+    mutable uint64_t chunkEpoch; // coldCache evictions when chunk was found
+
+    size_t size() const { return len; }
+    char operator[](size_t col) const {
+        size_t off = begin+col;
+        if (off < chunkBegin || off >= chunkEnd || (table->cold && chunkEpoch != table->coldCache.evictions))
+            FindChunk(off);
+        return chunk[off-chunkBegin];
+    }
+    void FindChunk(size_t off) const;
+};
+
+void LoadText(PieceTable& text, char* buff, size_t n);
+void LoadTextBlock(PieceTable& text, std::shared_ptr<const TextBlock> block, size_t n);
+void AppendOriginal(PieceTable& text, size_t start, size_t n);
+void InsertCStr(PieceTable& text, CursorPos& curPos, const char* s, size_t n);
+void EraseBetween(PieceTable& text, CursorPos begin, CursorPos end);
+size_t CountBetween(PieceTable const& text, CursorPos begin, CursorPos end);
+size_t PosToOffset(PieceTable const& text, CursorPos pos);
+CursorPos OffsetToPos(PieceTable const& text, size_t offset);
+size_t TextBytes(PieceTable const& text);
+void CopyBetween(PieceTable const& text, CursorPos begin, CursorPos end, char* out);
+
+#endif // PIECETABLE_H_
@@ -0,0 +1,244 @@
+#include "recovery.hpp"
+#include "file.hpp"
+#include "undo.hpp"
+#include "ioqueue.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define RECOVERY_MAGIC "EDITWAL1"
+
+// the journal starts with the version of the file its edits apply to
+struct RecoveryHeader {
+    char magic[8];
+    uint64_t hash, textSize;
+};
+
+// each record is a kind byte, offset, size, the bytes for inserts and
+// resets, then a check of all of that, a record cut off by a crash fails it
+static void Append(std::vector<char>& out, const void* p, size_t n) {
+    out.insert(out.end(), (const char*) p, (const char*) p + n);
+}
+
+static uint32_t RecordCheck(const char* s, size_t n) {
+    return (uint32_t) HashText(s, n);
+}
+
+static bool TruncateFile(FILE* fp) {
+    if (fflush(fp) != 0) return false;
+#ifdef _WIN32
+    if (_chsize(_fileno(fp), 0) != 0) return false;
+#else
+    if (ftruncate(fileno(fp), 0) != 0) return false;
+#endif
+    return fseek(fp, 0, SEEK_SET) == 0;
+}
+
+// the batch at end and a sync linked behind it, handed over as one
+// submission, a short write cancels the sync and the rest goes again
+static bool WriteBatch(IoQueue& q, int fd, const char* s, size_t n, uint64_t* end) {
+    for (;;) {
+        QueueIo(q, (IoRequest) { IO_WRITE, fd, (char*) s, n, *end, 0, false });
+        QueueIo(q, (IoRequest) { IO_SYNC, fd, NULL, 0, 0, 1, true });
+        SubmitIo(q);
+        int64_t written = -1, synced = -1;
+        IoCompletion c;
+        for (int i = 0; i < 2; ++i) {
+            if (!WaitIo(q, &c)) return false;
+            if (c.user == 0) written = c.res;
+            else synced = c.res;
+        }
+        if (written < 0) return false;
+        *end += written;
+        s += written;
+        n -= written;
+        if (n == 0) return synced == 0;
+        if (written == 0) return false;
+    }
+}
+
+// group commit, one write and one sync for everything queued meanwhile
+static void WriterLoop(RecoveryLog* log) {
+    std::vector<char> batch;
+    IoQueue q;
+    StartIo(q);
+#ifdef _WIN32
+    int fd = _fileno(log->fp);
+#else
+    int fd = fileno(log->fp);
+#endif
+    uint64_t end = 0; // the journal starts out empty
+    std::unique_lock<std::mutex> lock(log->lock);
+    for (;;) {
+        log->wake.wait(lock, [log] { return log->stop || log->truncate || !log->queued.empty(); });
+        if (!log->truncate && log->queued.empty()) break;
+        bool truncate = log->truncate;
+        log->truncate = false;
+        batch.swap(log->queued);
+        lock.unlock();
+
+        bool ok = !truncate || TruncateFile(log->fp);
+        if (truncate) end = 0;
+        ok = ok && WriteBatch(q, fd, batch.data(), batch.size(), &end);
+        batch.clear();
+
+        lock.lock();
+        if (!ok && !log->failed) {
+            log->failed = true;
+            fprintf(stderr, "WARNING: Couldn't write edit journal '%s', edits since the last save are not safe\n", log->path);
+        }
+    }
+    StopIo(q);
+}
+
+// the journal is empty until RebaseRecovery says which file it starts from
+bool StartRecovery(RecoveryLog& log, const char* path) {
+    log.fp = fopen(path, "wb");
+    if (log.fp == NULL) return false;
+    log.path = strdup(path);
+    log.stop = false;
+    log.failed = false;
+    log.writer = std::thread(WriterLoop, &log);
+    return true;
+}
+
+// writes out what is queued and removes the journal, nothing is left to
+// recover after a clean exit
+void StopRecovery(RecoveryLog& log) {
+    if (log.fp == NULL) return;
+    {
+        std::lock_guard<std::mutex> lock(log.lock);
+        log.stop = true;
+    }
+    log.wake.notify_one();
+    log.writer.join();
+    fclose(log.fp);
+    log.fp = NULL;
+    remove(log.path);
+    free(log.path);
+    log.path = NULL;
+}
+
+// the text is about to be saved, edits from here on still apply once it is
+void MarkRecovery(RecoveryLog& log) {
+    std::lock_guard<std::mutex> lock(log.lock);
+    log.marked = true;
+    log.sinceMark.clear();
+}
+
+// starts over from the file just saved, edits queued before it are dropped
+// if it was saved from a copy taken at MarkRecovery, edits made since are not
+void RebaseRecovery(RecoveryLog& log, uint64_t hash, size_t textSize) {
+    RecoveryHeader header = {};
+    memcpy(header.magic, RECOVERY_MAGIC, sizeof(header.magic));
+    header.hash = hash;
+    header.textSize = textSize;
+    {
+        std::lock_guard<std::mutex> lock(log.lock);
+        log.queued.clear();
+        Append(log.queued, &header, sizeof(header));
+        Append(log.queued, log.sinceMark.data(), log.sinceMark.size());
+        log.marked = false;
+        log.sinceMark.clear();
+        log.truncate = true;
+    }
+    log.wake.notify_one();
+}
+
+// O(n), erases only need the size, never the bytes erased
+void RecoverEdit(RecoveryLog& log, RecoveryKind kind, size_t offset, const char* s, size_t n) {
+    uint8_t k = kind;
+    uint64_t off = offset, size = n;
+    {
+        std::lock_guard<std::mutex> lock(log.lock);
+        size_t begin = log.queued.size();
+        Append(log.queued, &k, sizeof(k));
+        Append(log.queued, &off, sizeof(off));
+        Append(log.queued, &size, sizeof(size));
+        if (kind != RECOVERY_ERASE)
+            Append(log.queued, s, n);
+        uint32_t check = RecordCheck(log.queued.data() + begin, log.queued.size() - begin);
+        Append(log.queued, &check, sizeof(check));
+        if (log.marked)
+            Append(log.sinceMark, log.queued.data() + begin, log.queued.size() - begin);
+    }
+    log.wake.notify_one();
+}
+
+static CursorPos EndPos(Text const& text) {
+    return (CursorPos) { text.size()-1, text[text.size()-1].size() };
+}
+
+// applies the journal a crashed session left behind onto the text loaded from
+// the file it started from, as one transaction so it can be undone
+// stops at the first damaged record, everything before it was synced
+RecoveryResult ReplayRecovery(const char* path, uint64_t hash, size_t textSize,
+        UndoLog& undo, Buffer& buffer, uint64_t now) {
+    size_t size;
+    const char* data = MapFileReadOnly(path, &size);
+    if (data == NULL) return RECOVERY_NOTHING;
+
+    RecoveryHeader header;
+    if (size < sizeof(header)) {
+        UnmapFile(data, size);
+        return RECOVERY_NOTHING;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, RECOVERY_MAGIC, sizeof(header.magic)) != 0
+            || header.hash != hash || header.textSize != textSize) {
+        UnmapFile(data, size);
+        return RECOVERY_STALE;
+    }
+
+    BeginEdit(undo, buffer.cursor);
+    size_t replayed = 0;
+    const char* p = data + sizeof(header);
+    const char* end = data + size;
+    for (;;) {
+        uint8_t kind;
+        uint64_t offset, n;
+        uint32_t check;
+        const char* record = p;
+        if ((size_t)(end - p) < sizeof(kind) + sizeof(offset) + sizeof(n)) break;
+        memcpy(&kind, p, sizeof(kind)); p += sizeof(kind);
+        memcpy(&offset, p, sizeof(offset)); p += sizeof(offset);
+        memcpy(&n, p, sizeof(n)); p += sizeof(n);
+        const char* bytes = p;
+        if (kind != RECOVERY_ERASE) {
+            if ((uint64_t)(end - p) < n) break;
+            p += n;
+        }
+        if ((size_t)(end - p) < sizeof(check)) break;
+        memcpy(&check, p, sizeof(check)); p += sizeof(check);
+        if (check != RecordCheck(record, p - sizeof(check) - record)) break;
+
+        size_t textBytes = TextBytes(buffer.text);
+        if (kind == RECOVERY_INSERT && offset <= textBytes) {
+            CursorPos pos = OffsetToPos(buffer.text, offset);
+            RecordInsert(undo, buffer.text, pos, bytes, n);
+        }
+        else if (kind == RECOVERY_ERASE && offset <= textBytes && n <= textBytes - offset) {
+            RecordErase(undo, buffer.text, OffsetToPos(buffer.text, offset), OffsetToPos(buffer.text, offset + n));
+        }
+        else if (kind == RECOVERY_RESET) {
+            RecordErase(undo, buffer.text, (CursorPos) { 0, 0 }, EndPos(buffer.text));
+            CursorPos pos = { 0, 0 };
+            RecordInsert(undo, buffer.text, pos, bytes, n);
+        }
+        else {
+            break;
+        }
+        ++replayed;
+    }
+    UnmapFile(data, size);
+
+    ResetCursor(buffer.text, buffer.cursor, (CursorPos) { 0, 0 });
+    CommitEdit(undo, buffer, now);
+    return replayed > 0 ? RECOVERY_REPLAYED : RECOVERY_NOTHING;
+}
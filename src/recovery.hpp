@@ -0,0 +1,56 @@
+#ifndef RECOVERY_H_
+#define RECOVERY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct UndoLog;
+struct Buffer;
+
+enum RecoveryKind {
+    RECOVERY_INSERT,
+    RECOVERY_ERASE,
+    RECOVERY_RESET, // the whole text replaced, after a jump to a checkpoint
+};
+
+enum RecoveryResult {
+    RECOVERY_NOTHING,
+    RECOVERY_REPLAYED,
+    RECOVERY_STALE, // the journal is for another version of the file
+};
+
+// every edit since the last save, appended as it happens so a crash loses
+// nothing, the file on disk plus the journal is the buffer
+// a writer thread writes whatever queued up while it was syncing the last
+// batch in one go, so editing never waits on the disk
+struct RecoveryLog {
+    FILE* fp = NULL;
+    char* path = NULL;
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<char> queued; // not written yet
+    bool truncate = false; // the file saved, queued starts a new journal
+    // a save of the text as it was at MarkRecovery is running, edits since
+    // are kept to start the journal that follows it
+    bool marked = false;
+    std::vector<char> sinceMark;
+    bool stop = false;
+    bool failed = false;
+};
+
+bool StartRecovery(RecoveryLog& log, const char* path);
+void StopRecovery(RecoveryLog& log);
+void MarkRecovery(RecoveryLog& log);
+void RebaseRecovery(RecoveryLog& log, uint64_t hash, size_t textSize);
+void RecoverEdit(RecoveryLog& log, RecoveryKind kind, size_t offset, const char* s, size_t n);
+
+RecoveryResult ReplayRecovery(const char* path, uint64_t hash, size_t textSize,
+        UndoLog& undo, Buffer& buffer, uint64_t now);
+
+#endif // RECOVERY_H_
@@ -0,0 +1,313 @@
+#include "reload.hpp"
+#include "file.hpp"
+#include "format.hpp"
+#include "undo.hpp"
+
+#include <string.h>
+
+// bytes of a line of the file as the text has it, without the \r of crlf
+struct Span {
+    size_t begin, end;
+};
+
+// what the line diff compares, the bytes only when hashes match by chance
+struct LineKey {
+    uint64_t hash;
+    size_t size;
+};
+
+static void CopyLine(Text const& text, size_t ln, std::vector<char>& out) {
+    size_t n = text[ln].size();
+    out.resize(n);
+    CopyBetween(text, (CursorPos) { ln, 0 }, (CursorPos) { ln, n }, out.data());
+}
+
+static bool SameLine(std::vector<char> const& line, const char* data, Span s) {
+    return line.size() == s.end - s.begin && (line.empty() || memcmp(line.data(), data + s.begin, line.size()) == 0);
+}
+
+// the line starting at off, next is set to where the one after it starts,
+// past size if it is the last
+static Span LineAt(const char* data, size_t size, size_t off, bool crlf, size_t* next) {
+    const char* nl = (const char*) memchr(data + off, '\n', size - off);
+    if (nl == NULL) {
+        *next = size + 1;
+        return (Span) { off, size };
+    }
+    size_t end = nl - data;
+    *next = end + 1;
+    if (crlf && end > off && data[end-1] == '\r') --end;
+    return (Span) { off, end };
+}
+
+// the line that ends at end, its '\n' or size for the last
+static Span LineBefore(const char* data, size_t size, size_t end, bool crlf) {
+    size_t begin = end;
+    while (begin > 0 && data[begin-1] != '\n') --begin;
+    if (crlf && end < size && end > begin && data[end-1] == '\r') --end;
+    return (Span) { begin, end };
+}
+
+// the furthest x diagonal k of a diff reaches with d edits before following
+// matches, from trace[d-1], -1 if it can't be reached
+static long Step(std::vector<long> const& prev, long d, long k, long n, long m, bool* down) {
+    long best = -1;
+    if (k+1 <= d-1) {
+        long x = prev[k+1 + d-1];
+        if (x >= 0 && x - k <= m) {
+            best = x;
+            *down = true;
+        }
+    }
+    if (k-1 >= -(d-1)) {
+        long x = prev[k-1 + d-1];
+        if (x >= 0 && x+1 <= n && x+1 > best) {
+            best = x+1;
+            *down = false;
+        }
+    }
+    return best;
+}
+
+// myers' diff of the lines, the hunks turning a into b, lines counted from
+// the start of a
+// false if that takes more than maxEdits, O((n+m) maxEdits) time and
+// O(maxEdits^2) memory at most
+static bool DiffLines(std::vector<LineKey> const& a, std::vector<LineKey> const& b, long maxEdits,
+        std::vector<Hunk>& out) {
+    long n = a.size(), m = b.size();
+    std::vector<std::vector<long>> trace;
+    long endD = -1, endK = 0;
+    for (long d = 0; d <= maxEdits && endD < 0; ++d) {
+        std::vector<long> v(2*d+1, -1);
+        for (long k = -d; k <= d; k += 2) {
+            bool down = false;
+            long x = d == 0 ? 0 : Step(trace[d-1], d, k, n, m, &down);
+            if (x < 0) continue;
+            long y = x - k;
+            while (x < n && y < m && a[x].hash == b[y].hash && a[x].size == b[y].size) {
+                ++x;
+                ++y;
+            }
+            v[k+d] = x;
+            if (x == n && y == m) {
+                endD = d;
+                endK = k;
+                break;
+            }
+        }
+        trace.push_back(std::move(v));
+    }
+    if (endD < 0) return false;
+
+    // walks the edits back from the end, each a line of a dropped or one of
+    // b added, then joins those next to each other
+    struct Edit { long x, y; bool down; };
+    std::vector<Edit> edits;
+    for (long d = endD, k = endK; d > 0; --d) {
+        bool down = false;
+        Step(trace[d-1], d, k, n, m, &down);
+        long prevK = down ? k+1 : k-1;
+        long prevX = trace[d-1][prevK + d-1];
+        edits.push_back((Edit) { prevX, prevX - prevK, down });
+        k = prevK;
+    }
+    out.clear();
+    long a1 = -1, b1 = -1;
+    for (size_t i = edits.size(); i-- > 0;) {
+        Edit e = edits[i];
+        if (out.empty() || e.x != a1 || e.y != b1) {
+            out.push_back((Hunk) { (size_t) e.x, 0, 0 });
+            a1 = e.x;
+            b1 = e.y;
+        }
+        if (e.down) {
+            ++out.back().newCount;
+            ++b1;
+        }
+        else {
+            ++out.back().oldCount;
+            ++a1;
+        }
+    }
+    return true;
+}
+
+// the hash LoadText would have given the file once decoded, n is that size
+// crlf is undone in chunks, parts passed on are whole words but for the last
+static uint64_t HashDecoded(const char* data, size_t size, bool crlf, size_t n) {
+    if (!crlf) return HashText(data, size);
+    uint64_t h = HashTextBegin(n);
+    std::vector<char> buff(FILE_CHUNK_SIZE + 8);
+    size_t carry = 0;
+    for (size_t off = 0; off < size;) {
+        size_t len = size - off < FILE_CHUNK_SIZE ? size - off : FILE_CHUNK_SIZE;
+        // a \r the next chunk may pair with waits for it
+        if (off + len < size && len > 1 && data[off+len-1] == '\r') --len;
+        memcpy(buff.data() + carry, data + off, len);
+        size_t k = carry + StripCarriageReturns(buff.data() + carry, len);
+        off += len;
+        size_t whole = off == size ? k : k & ~(size_t)7;
+        h = HashTextPart(h, buff.data(), whole);
+        memmove(buff.data(), buff.data() + whole, k - whole);
+        carry = k - whole;
+    }
+    return HashTextEnd(h);
+}
+
+// replaces text lines [a0, a1) with file lines [b0, b1) of m, the text has
+// n lines, only the last line of either has no '\n'
+// lines has the file lines from first on
+static void ApplyHunk(UndoLog& undo, Text& text, size_t a0, size_t a1, size_t n,
+        size_t b0, size_t b1, size_t m, const char* data, Span const* lines, size_t first) {
+    std::vector<char> bytes;
+    for (size_t k = b0; k < b1; ++k) {
+        Span s = lines[k - first];
+        bytes.insert(bytes.end(), data + s.begin, data + s.end);
+        if (k+1 < m) bytes.push_back('\n');
+    }
+    CursorPos pos = { a0, 0 };
+    if (a1 < n) {
+        RecordErase(undo, text, pos, (CursorPos) { a1, 0 });
+        RecordInsert(undo, text, pos, bytes.data(), bytes.size());
+        return;
+    }
+    // only the hunk at the bottom gets here, the first applied, so the text
+    // still has all n lines
+    CursorPos end = { n-1, text[n-1].size() };
+    if (a0 < n && b0 < m) {
+        RecordErase(undo, text, pos, end);
+    }
+    else if (a0 == n) {
+        // lines added after the last, which had no '\n'
+        bytes.insert(bytes.begin(), '\n');
+        pos = end;
+    }
+    else {
+        // the last lines dropped, the one before them loses its '\n'
+        pos = (CursorPos) { a0-1, text[a0-1].size() };
+        RecordErase(undo, text, pos, end);
+    }
+    RecordInsert(undo, text, pos, bytes.data(), bytes.size());
+}
+
+// brings the text in line with the file as it is now, as one edit that can
+// be undone, only lines that differ are touched
+// the lines the same at the top and bottom are found by comparing, the ones
+// between are diffed by their hashes, hunks says what changed
+// the cursor stays on the line it was on, outHash is of the text now
+// 0 success
+// 1 file error (errno)
+int ReloadText(UndoLog& undo, Buffer& buffer, const char* filename, uint64_t now,
+        std::vector<Hunk>& hunks, uint64_t* outHash) {
+    hunks.clear();
+    FileStamp stamp;
+    if (!StampFile(filename, &stamp)) return 1;
+    size_t size = 0;
+    const char* mapped = MapFileReadOnly(filename, &size);
+    if (mapped == NULL && stamp.size != 0) return 1;
+    const char* data = mapped != NULL ? mapped : "";
+
+    buffer.format = DetectFormat(data, size);
+    bool crlf = buffer.format.lineEnding == LINE_ENDING_CRLF;
+    Text& text = buffer.text;
+    size_t n = text.size();
+    std::vector<char> line;
+
+    // off is where file line p starts, past size once there are none left
+    size_t p = 0, off = 0;
+    while (p < n && off <= size) {
+        size_t next;
+        Span s = LineAt(data, size, off, crlf, &next);
+        CopyLine(text, p, line);
+        if (!SameLine(line, data, s)) break;
+        ++p;
+        off = next;
+    }
+    // midEnd is where the q lines the same at the bottom start
+    size_t q = 0, midEnd = size + 1;
+    if (off <= size) {
+        for (size_t end = size; q < n - p;) {
+            Span s = LineBefore(data, size, end, crlf);
+            if (s.begin < off) break;
+            CopyLine(text, n-1-q, line);
+            if (!SameLine(line, data, s)) break;
+            ++q;
+            midEnd = s.begin;
+            if (s.begin == 0) break;
+            end = s.begin - 1;
+        }
+    }
+    std::vector<Span> mid;
+    for (size_t o = off; o <= size && o < midEnd;) {
+        size_t next;
+        mid.push_back(LineAt(data, size, o, crlf, &next));
+        o = next;
+    }
+    size_t oldCount = n - q - p;
+    size_t m = p + mid.size() + q;
+
+    if (oldCount > 0 || !mid.empty()) {
+        bool diffed = false;
+        if (oldCount <= RELOAD_DIFF_MAX_LINES && mid.size() <= RELOAD_DIFF_MAX_LINES) {
+            std::vector<LineKey> a(oldCount), b(mid.size());
+            for (size_t i = 0; i < oldCount; ++i) {
+                CopyLine(text, p+i, line);
+                a[i] = (LineKey) { HashText(line.data(), line.size()), line.size() };
+            }
+            for (size_t i = 0; i < mid.size(); ++i)
+                b[i] = (LineKey) { HashText(data + mid[i].begin, mid[i].end - mid[i].begin), mid[i].end - mid[i].begin };
+            diffed = DiffLines(a, b, RELOAD_DIFF_MAX_EDITS, hunks);
+        }
+        if (!diffed) {
+            hunks.assign(1, (Hunk) { 0, oldCount, mid.size() });
+        }
+
+        // applied from the bottom up, so the lines of the ones above stay put
+        // where each starts in the file, lines between them are the same
+        std::vector<size_t> starts(hunks.size());
+        size_t shift = 0;
+        for (size_t i = 0; i < hunks.size(); ++i) {
+            hunks[i].line += p;
+            starts[i] = hunks[i].line + shift;
+            shift += hunks[i].newCount - hunks[i].oldCount;
+        }
+        BeginEdit(undo, buffer.cursor);
+        for (size_t i = hunks.size(); i-- > 0;) {
+            Hunk h = hunks[i];
+            ApplyHunk(undo, text, h.line, h.line + h.oldCount, n,
+                    starts[i], starts[i] + h.newCount, m, data, mid.data(), p);
+        }
+        CursorPos pos = buffer.cursor.curPos;
+        pos.ln = ShiftLine(hunks, pos.ln);
+        if (pos.ln >= text.size()) pos.ln = text.size()-1;
+        StopSelecting(buffer.cursor);
+        ResetCursor(text, buffer.cursor, pos);
+        CommitSeparateEdit(undo, buffer, now);
+    }
+
+    if (outHash != NULL) *outHash = HashDecoded(data, size, crlf, TextBytes(text));
+    UnmapFile(mapped, size);
+    return 0;
+}
+
+// where line ln of the text before a reload ended up, a line in a hunk
+// stays as far into it as the hunk still goes, one in a hunk that drops all
+// its lines goes to the line after it, which is past the end for the last
+size_t ShiftLine(std::vector<Hunk> const& hunks, size_t ln) {
+    size_t shifted = ln;
+    for (Hunk const& h : hunks) {
+        if (h.line + h.oldCount <= ln) {
+            shifted = shifted + h.newCount - h.oldCount;
+        }
+        else {
+            if (h.line <= ln) {
+                size_t into = ln - h.line;
+                if (into >= h.newCount) into = h.newCount > 0 ? h.newCount-1 : 0;
+                return shifted - (ln - h.line) + into;
+            }
+            break;
+        }
+    }
+    return shifted;
+}
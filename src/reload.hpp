@@ -0,0 +1,28 @@
+#ifndef RELOAD_H_
+#define RELOAD_H_
+
+#include "buffer.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct UndoLog;
+
+// lines [line, line+oldCount) of the text before a reload became newCount
+// lines of the file
+struct Hunk {
+    size_t line, oldCount, newCount;
+};
+
+// a changed region this many lines long on either side is diffed no
+// further, it is replaced as one hunk
+#define RELOAD_DIFF_MAX_LINES ((size_t)1 << 20)
+// edits the line diff looks for at most before it gives up the same way
+#define RELOAD_DIFF_MAX_EDITS 1024
+
+int ReloadText(UndoLog& undo, Buffer& buffer, const char* filename, uint64_t now,
+        std::vector<Hunk>& hunks, uint64_t* outHash);
+size_t ShiftLine(std::vector<Hunk> const& hunks, size_t ln);
+
+#endif // RELOAD_H_
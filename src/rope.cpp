@@ -0,0 +1,332 @@
+#include "rope.hpp"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::shared_ptr<RopeNode> RopePtr;
+
+static size_t CountNewlines(const char* s, size_t n) {
+    size_t k = 0;
+    for (const char* p = s;
+        (p = (const char*) memchr(p, '\n', n - (p-s))) != NULL;
+        ++p)
+    {
+        ++k;
+    }
+    return k;
+}
+
+static bool IsLeaf(RopeNode const& node) {
+    return node.children.empty();
+}
+
+static bool IsUnderfull(RopeNode const& node) {
+    if (IsLeaf(node))
+        return node.text.size() < ROPE_CHUNK_MIN;
+    return node.children.size() < ROPE_FANOUT/2;
+}
+
+static void SumChildren(RopeNode& node) {
+    node.bytes = 0;
+    node.newlines = 0;
+    for (RopePtr const& child : node.children) {
+        node.bytes += child->bytes;
+        node.newlines += child->newlines;
+    }
+}
+
+// copy on write, nodes may be shared with other copies of the rope
+static RopeNode& Mutable(RopePtr& ptr) {
+    if (ptr.use_count() > 1)
+        ptr = std::make_shared<RopeNode>(*ptr);
+    return *ptr;
+}
+
+// moves the second half of an overfull node into a new sibling
+static RopePtr SplitNode(RopeNode& node) {
+    RopePtr sibling = std::make_shared<RopeNode>();
+    if (IsLeaf(node)) {
+        size_t half = node.text.size()/2;
+        sibling->text.assign(node.text.begin()+half, node.text.end());
+        node.text.resize(half);
+        sibling->bytes = sibling->text.size();
+        sibling->newlines = CountNewlines(sibling->text.data(), sibling->bytes);
+        node.bytes -= sibling->bytes;
+        node.newlines -= sibling->newlines;
+    }
+    else {
+        size_t half = node.children.size()/2;
+        sibling->children.assign(node.children.begin()+half, node.children.end());
+        node.children.resize(half);
+        SumChildren(*sibling);
+        SumChildren(node);
+    }
+    return sibling;
+}
+
+// n must be at most ROPE_CHUNK_MAX, so that a node splits at most once
+// returns the new right sibling if the node had to split
+static RopePtr Insert(RopePtr& ptr, size_t off, const char* s, size_t n, size_t nl) {
+    RopeNode& node = Mutable(ptr);
+    node.bytes += n;
+    node.newlines += nl;
+    if (IsLeaf(node)) {
+        node.text.insert(node.text.begin()+off, s, s+n);
+        if (node.text.size() <= ROPE_CHUNK_MAX)
+            return NULL;
+        return SplitNode(node);
+    }
+
+    size_t i = 0;
+    for (; i+1 < node.children.size() && off > node.children[i]->bytes; ++i)
+        off -= node.children[i]->bytes;
+    RopePtr sibling = Insert(node.children[i], off, s, n, nl);
+    if (sibling == NULL)
+        return NULL;
+    node.children.insert(node.children.begin()+i+1, sibling);
+    if (node.children.size() <= ROPE_FANOUT)
+        return NULL;
+    return SplitNode(node);
+}
+
+// merges child i with a neighbour if it became too small
+// returns true if the number of children changed
+static bool Rebalance(RopeNode& node, size_t i) {
+    if (i >= node.children.size() || node.children.size() < 2)
+        return false;
+    if (!IsUnderfull(*node.children[i]))
+        return false;
+
+    size_t j = i+1 < node.children.size() ? i : i-1;
+    RopeNode& left = Mutable(node.children[j]);
+    RopeNode const& right = *node.children[j+1];
+    if (IsLeaf(left)) {
+        left.text.insert(left.text.end(), right.text.begin(), right.text.end());
+    }
+    else {
+        left.children.insert(left.children.end(), right.children.begin(), right.children.end());
+    }
+    left.bytes += right.bytes;
+    left.newlines += right.newlines;
+    node.children.erase(node.children.begin()+j+1);
+
+    if ((IsLeaf(left) && left.text.size() > ROPE_CHUNK_MAX) ||
+        (!IsLeaf(left) && left.children.size() > ROPE_FANOUT))
+    {
+        RopePtr sibling = SplitNode(left);
+        node.children.insert(node.children.begin()+j+1, sibling);
+        return false;
+    }
+    return true;
+}
+
+static void Erase(RopePtr& ptr, size_t b, size_t e) {
+    RopeNode& node = Mutable(ptr);
+    if (IsLeaf(node)) {
+        size_t nl = CountNewlines(node.text.data()+b, e-b);
+        node.text.erase(node.text.begin()+b, node.text.begin()+e);
+        node.bytes -= e-b;
+        node.newlines -= nl;
+        return;
+    }
+
+    size_t i = 0, base = 0;
+    while (base + node.children[i]->bytes <= b) {
+        base += node.children[i]->bytes;
+        ++i;
+    }
+    size_t first = i;
+    while (i < node.children.size() && base < e) {
+        size_t cb = base, ce = base + node.children[i]->bytes;
+        base = ce;
+        if (b <= cb && ce <= e) {
+            node.children.erase(node.children.begin()+i);
+            continue;
+        }
+        Erase(node.children[i], (b > cb ? b : cb) - cb, (e < ce ? e : ce) - cb);
+        ++i;
+    }
+
+    // at most two children were cut partially, both now around index first
+    for (size_t k = first; k < first+2 && k < node.children.size();) {
+        if (!Rebalance(node, k))
+            ++k;
+    }
+    SumChildren(node);
+}
+
+static size_t LineStart(Rope const& t, size_t ln) {
+    // offset just past the ln-th newline
+    if (ln == 0) return 0;
+    assert(ln <= t.root->newlines);
+    size_t base = 0, k = ln;
+    RopeNode const* node = t.root.get();
+    while (!IsLeaf(*node)) {
+        for (RopePtr const& child : node->children) {
+            if (k <= child->newlines) {
+                node = child.get();
+                break;
+            }
+            k -= child->newlines;
+            base += child->bytes;
+        }
+    }
+    const char* s = node->text.data();
+    const char* p = s;
+    for (;; ++p) {
+        p = (const char*) memchr(p, '\n', node->bytes - (p-s));
+        if (--k == 0) break;
+    }
+    return base + (p-s) + 1;
+}
+
+size_t PosToOffset(Rope const& text, CursorPos pos) {
+    return LineStart(text, pos.ln) + pos.col;
+}
+
+CursorPos OffsetToPos(Rope const& text, size_t offset) {
+    assert(offset <= TextBytes(text));
+    // count the newlines before offset
+    size_t ln = 0, base = 0;
+    RopeNode const* node = text.root.get();
+    while (!IsLeaf(*node)) {
+        RopeNode const* next = NULL;
+        for (RopePtr const& child : node->children) {
+            if (offset < base + child->bytes) {
+                next = child.get();
+                break;
+            }
+            ln += child->newlines;
+            base += child->bytes;
+        }
+        if (next == NULL) break; // offset is the end of the document
+        node = next;
+    }
+    if (IsLeaf(*node))
+        ln += CountNewlines(node->text.data(), offset - base);
+    return (CursorPos) { ln, offset - LineStart(text, ln) };
+}
+
+size_t TextBytes(Rope const& text) {
+    return text.root->bytes;
+}
+
+RopeLine Rope::operator[](size_t ln) const {
+    size_t begin = LineStart(*this, ln);
+    size_t end = ln+1 < size() ? LineStart(*this, ln+1)-1 : root->bytes;
+    return (RopeLine) { this, begin, end-begin, NULL, 0, 0 };
+}
+
+void RopeLine::FindChunk(size_t off) const {
+    size_t base = 0;
+    RopeNode const* node = rope->root.get();
+    while (!IsLeaf(*node)) {
+        for (RopePtr const& child : node->children) {
+            if (off < base + child->bytes) {
+                node = child.get();
+                break;
+            }
+            base += child->bytes;
+        }
+    }
+    assert(off < base + node->bytes);
+    chunk = node->text.data();
+    chunkBegin = base;
+    chunkEnd = base + node->bytes;
+}
+
+// builds the tree bottom up, leaving some room in each chunk for typing
+void LoadText(Rope& text, char* buff, size_t n) {
+    text.version = NextTextVersion();
+    std::vector<RopePtr> level;
+    size_t const chunk = ROPE_CHUNK_MAX*3/4;
+    for (size_t i = 0; i < n; i += chunk) {
+        size_t m = n-i < chunk ? n-i : chunk;
+        RopePtr leaf = std::make_shared<RopeNode>();
+        leaf->text.assign(buff+i, buff+i+m);
+        leaf->bytes = m;
+        leaf->newlines = CountNewlines(buff+i, m);
+        level.push_back(leaf);
+    }
+    free(buff);
+
+    while (level.size() > 1) {
+        std::vector<RopePtr> parents;
+        for (size_t i = 0; i < level.size(); i += ROPE_FANOUT) {
+            RopePtr parent = std::make_shared<RopeNode>();
+            size_t end = i+ROPE_FANOUT < level.size() ? i+ROPE_FANOUT : level.size();
+            parent->children.assign(level.begin()+i, level.begin()+end);
+            SumChildren(*parent);
+            parents.push_back(parent);
+        }
+        level.swap(parents);
+    }
+    text.root = level.empty() ? std::make_shared<RopeNode>() : level[0];
+}
+
+void InsertCStr(Rope& text, CursorPos& curPos, const char* s, size_t n) {
+    text.version = NextTextVersion();
+    size_t off = PosToOffset(text, curPos);
+    for (size_t i = 0; i < n; i += ROPE_CHUNK_MAX) {
+        size_t m = n-i < ROPE_CHUNK_MAX ? n-i : ROPE_CHUNK_MAX;
+        size_t nl = CountNewlines(s+i, m);
+        RopePtr sibling = Insert(text.root, off+i, s+i, m, nl);
+        if (sibling != NULL) {
+            RopePtr root = std::make_shared<RopeNode>();
+            root->children.push_back(text.root);
+            root->children.push_back(sibling);
+            SumChildren(*root);
+            text.root = root;
+        }
+        for (size_t j = 0; j < m; ++j) {
+            if (s[i+j] == '\n') {
+                ++curPos.ln;
+                curPos.col = 0;
+            }
+            else {
+                ++curPos.col;
+            }
+        }
+    }
+}
+
+void EraseBetween(Rope& text, CursorPos begin, CursorPos end) {
+    text.version = NextTextVersion();
+    size_t b = PosToOffset(text, begin);
+    size_t e = PosToOffset(text, end);
+    assert(b <= e);
+    if (b == e) return;
+    Erase(text.root, b, e);
+    while (text.root->children.size() == 1) {
+        RopePtr child = text.root->children[0];
+        text.root = child;
+    }
+}
+
+size_t CountBetween(Rope const& text, CursorPos begin, CursorPos end) {
+    return PosToOffset(text, end) - PosToOffset(text, begin);
+}
+
+static void CopyRange(RopeNode const& node, size_t base, size_t b, size_t e, char* out) {
+    // base is the document offset of node
+    if (IsLeaf(node)) {
+        size_t lo = base > b ? base : b;
+        size_t hi = base + node.bytes < e ? base + node.bytes : e;
+        if (lo < hi) {
+            memcpy(out + (lo-b), node.text.data() + (lo-base), hi-lo);
+        }
+        return;
+    }
+    for (RopePtr const& child : node.children) {
+        if (base >= e) break;
+        if (base + child->bytes > b) {
+            CopyRange(*child, base, b, e, out);
+        }
+        base += child->bytes;
+    }
+}
+
+void CopyBetween(Rope const& text, CursorPos begin, CursorPos end, char* out) {
+    CopyRange(*text.root, 0, PosToOffset(text, begin), PosToOffset(text, end), out);
+}
@@ -0,0 +1,60 @@
+#ifndef ROPE_H_
+#define ROPE_H_
+
+#include "storage.hpp"
+
+#include <memory>
+#include <vector>
+
+#define ROPE_CHUNK_MIN 1024
+#define ROPE_CHUNK_MAX 4096
+#define ROPE_FANOUT 16
+
+// leaves hold the text in chunks of ROPE_CHUNK_MIN..ROPE_CHUNK_MAX bytes,
+// every node caches the byte and newline count of its subtree
+// nodes are shared between copies and only cloned when written to
+struct RopeNode {
+    size_t bytes, newlines;
+    std::vector<std::shared_ptr<RopeNode>> children; // empty for leaves
+    std::vector<char> text;
+};
+
+struct RopeLine;
+
+// B-tree of text chunks, all leaves are at the same depth
+struct Rope {
+    std::shared_ptr<RopeNode> root = std::make_shared<RopeNode>();
+    uint64_t version = 0; // see NextTextVersion
+
+    size_t size() const { return root->newlines + 1; }
+    RopeLine operator[](size_t ln) const;
+};
+
+// lines may span chunks, so they are accessed through a view which remembers
+// the last chunk it read from
+struct RopeLine {
+    Rope const* rope;
+    size_t begin, len;
+    mutable const char* chunk;
+    mutable size_t chunkBegin, chunkEnd; // document offsets covered by chunk
+
+    size_t size() const { return len; }
+    char operator[](size_t col) const {
+        size_t off = begin+col;
+        if (off < chunkBegin || off >= chunkEnd)
+            FindChunk(off);
+        return chunk[off-chunkBegin];
+    }
+    void FindChunk(size_t off) const;
+};
+
+void LoadText(Rope& text, char* buff, size_t n);
+void InsertCStr(Rope& text, CursorPos& curPos, const char* s, size_t n);
+void EraseBetween(Rope& text, CursorPos begin, CursorPos end);
+size_t CountBetween(Rope const& text, CursorPos begin, CursorPos end);
+size_t PosToOffset(Rope const& text, CursorPos pos);
+CursorPos OffsetToPos(Rope const& text, size_t offset);
+size_t TextBytes(Rope const& text);
+void CopyBetween(Rope const& text, CursorPos begin, CursorPos end, char* out);
+
+#endif // ROPE_H_
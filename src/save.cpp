@@ -0,0 +1,211 @@
+#include "save.hpp"
+#include "file.hpp"
+#include "undo.hpp"
+#include "ioqueue.hpp"
+
+#include <errno.h>
+#include <stdlib.h>
+
+// n bytes on from pos, found by walking lines rather than with OffsetToPos,
+// which may update an index the text shares with a copy on another thread
+static CursorPos Advance(Text const& text, CursorPos pos, size_t n) {
+    while (pos.ln+1 < text.size()) {
+        size_t rest = text[pos.ln].size() - pos.col + 1;
+        if (n < rest) break;
+        n -= rest;
+        ++pos.ln;
+        pos.col = 0;
+    }
+    pos.col += n;
+    return pos;
+}
+
+// a chunk on its way to the file, what is left of it to write
+struct SaveSlot {
+    const char* data;
+    size_t n;
+    uint64_t at;
+};
+
+// picks up at least one write that completed, requeues what a short write
+// left, the slots of the others are free again
+// 0 or 3 as SaveText returns them
+static int CompleteWrites(IoQueue& q, int fd, SaveSlot* slots, size_t* freeSlots, size_t* numFree) {
+    IoCompletion c;
+    if (!WaitIo(q, &c)) return 3;
+    do {
+        SaveSlot& s = slots[c.user];
+        if (c.res <= 0) {
+            errno = c.res < 0 ? (int) -c.res : EIO;
+            return 3;
+        }
+        if ((size_t) c.res < s.n) {
+            s.data += c.res;
+            s.n -= c.res;
+            s.at += c.res;
+            QueueIo(q, (IoRequest) { IO_WRITE, fd, (char*) s.data, s.n, s.at, c.user, false });
+        }
+        else {
+            freeSlots[(*numFree)++] = c.user;
+        }
+    } while (PollIo(q, &c));
+    return 0;
+}
+
+// streams the text out FILE_CHUNK_SIZE at a time, so saving takes no more
+// memory than SAVE_CHUNKS_IN_FLIGHT of those however big the text, and
+// hashes it on the way
+// the chunks go through an IoQueue, written while the next ones are copied
+// out, each batch handed over at once
+// line endings are written the way the file had them, the hash and size are
+// of the text itself, the same as when it was loaded
+// the file is only replaced once all of it is on disk, see AtomicFile
+// -2 malloc failed
+// 0 success
+// 1 file error (errno)
+// 3 write failed (errno)
+// 4 stopped by cancel, the file is untouched
+int SaveText(Text const& text, LineEnding lineEnding, const char* filename,
+        uint64_t* outHash, size_t* outSize, std::atomic<bool> const* cancel) {
+    AtomicFile f;
+    if (OpenAtomicFile(&f, filename) != 0) {
+        return 1;
+    }
+    // a slot takes a chunk, then the chunk encoded, twice as big at most
+    char* chunks = (char*) malloc(SAVE_CHUNKS_IN_FLIGHT * 3 * FILE_CHUNK_SIZE);
+    if (chunks == NULL) {
+        AbortAtomicFile(&f);
+        return -2;
+    }
+    // written straight from the chunks, never through stdio
+#ifdef _WIN32
+    int fd = _fileno(f.fp);
+#else
+    int fd = fileno(f.fp);
+#endif
+    IoQueue q;
+    StartIo(q);
+    SaveSlot slots[SAVE_CHUNKS_IN_FLIGHT];
+    size_t freeSlots[SAVE_CHUNKS_IN_FLIGHT];
+    size_t numFree = SAVE_CHUNKS_IN_FLIGHT;
+    for (size_t i = 0; i < SAVE_CHUNKS_IN_FLIGHT; ++i)
+        freeSlots[i] = i;
+
+    int err = 0;
+    size_t size = TextBytes(text);
+    uint64_t hash = HashTextBegin(size);
+    uint64_t at = 0;
+    CursorPos pos = { 0, 0 };
+    for (size_t off = 0; off < size && err == 0;) {
+        if (cancel != NULL && *cancel) {
+            err = 4;
+            break;
+        }
+        if (numFree == 0) {
+            err = CompleteWrites(q, fd, slots, freeSlots, &numFree);
+            continue;
+        }
+        size_t k = freeSlots[--numFree];
+        char* chunk = chunks + k * 3 * FILE_CHUNK_SIZE;
+        size_t n = size - off < FILE_CHUNK_SIZE ? size - off : FILE_CHUNK_SIZE;
+        CursorPos next = Advance(text, pos, n);
+        CopyBetween(text, pos, next, chunk);
+        hash = HashTextPart(hash, chunk, n);
+        char* encoded = chunk + FILE_CHUNK_SIZE;
+        size_t m = EncodeLineEndings(chunk, n, encoded, lineEnding);
+        slots[k] = (SaveSlot) { encoded, m, at };
+        QueueIo(q, (IoRequest) { IO_WRITE, fd, encoded, m, at, k, false });
+        // once every slot is full the batch goes, waiting on it submits it too
+        if (numFree == 0) SubmitIo(q);
+        at += m;
+        off += n;
+        pos = next;
+    }
+    while (err == 0 && numFree < SAVE_CHUNKS_IN_FLIGHT) {
+        err = CompleteWrites(q, fd, slots, freeSlots, &numFree);
+    }
+    // nothing may still be writing from the chunks once they are freed
+    int sysErr = errno;
+    StopIo(q);
+    free(chunks);
+    if (err != 0) {
+        AbortAtomicFile(&f);
+        errno = sysErr;
+        return err;
+    }
+
+    if (CommitAtomicFile(&f) != 0) {
+        return 1;
+    }
+    if (outHash != NULL) *outHash = HashTextEnd(hash);
+    if (outSize != NULL) *outSize = size;
+    return 0;
+}
+
+static void SaveLoop(Saver* saver) {
+    std::unique_lock<std::mutex> lock(saver->lock);
+    for (;;) {
+        saver->wake.wait(lock, [saver] { return saver->stop || saver->next; });
+        if (!saver->next) break;
+        std::unique_ptr<Text> text = std::move(saver->next);
+        LineEnding lineEnding = saver->nextLineEnding;
+        uint64_t id = saver->nextId;
+        saver->cancel = false;
+        lock.unlock();
+
+        SaveResult r = {};
+        r.id = id;
+        r.err = SaveText(*text, lineEnding, saver->filename, &r.hash, &r.size, &saver->cancel);
+        r.sysErr = errno;
+        text.reset(); // the copy goes away here rather than on the main thread
+
+        lock.lock();
+        if (r.err == 4) continue; // the one that stopped it is queued
+        saver->result = r;
+        saver->finished = true;
+    }
+}
+
+// filename must outlive the saver
+void StartSaver(Saver& saver, const char* filename) {
+    saver.filename = filename;
+    saver.stop = false;
+    saver.finished = false;
+    saver.worker = std::thread(SaveLoop, &saver);
+}
+
+// O(copying text), returns the id its result will have
+uint64_t QueueSave(Saver& saver, Text const& text, LineEnding lineEnding) {
+    std::unique_ptr<Text> copy(new Text(text));
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(saver.lock);
+        saver.next = std::move(copy);
+        saver.nextLineEnding = lineEnding;
+        id = ++saver.nextId;
+        saver.cancel = true;
+    }
+    saver.wake.notify_one();
+    return id;
+}
+
+// true once a save finished, results of saves superseded before they got to
+// stop may still come in, ids tell them apart
+bool PollSave(Saver& saver, SaveResult* out) {
+    std::lock_guard<std::mutex> lock(saver.lock);
+    if (!saver.finished) return false;
+    *out = saver.result;
+    saver.finished = false;
+    return true;
+}
+
+// finishes what is running and queued first, nothing asked to be saved is lost
+void StopSaver(Saver& saver) {
+    if (!saver.worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(saver.lock);
+        saver.stop = true;
+    }
+    saver.wake.notify_one();
+    saver.worker.join();
+}
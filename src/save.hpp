@@ -0,0 +1,51 @@
+#ifndef SAVE_H_
+#define SAVE_H_
+
+#include "buffer.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// chunks copied out of the text while the ones before them are written
+#define SAVE_CHUNKS_IN_FLIGHT 4
+
+struct SaveResult {
+    uint64_t id; // from QueueSave
+    int err; // from SaveText
+    int sysErr; // errno, if err is 1
+    uint64_t hash;
+    size_t size;
+};
+
+// saves run on a worker from a copy of the text, cheap for the piece table and
+// immer text which share everything but their edits, so editing goes on
+// a save queued while another runs stops that one, only the newer text is
+// written
+struct Saver {
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    const char* filename = NULL;
+    std::unique_ptr<Text> next; // queued, not started yet
+    LineEnding nextLineEnding = LINE_ENDING_LF;
+    uint64_t nextId = 0;
+    std::atomic<bool> cancel{false}; // the save running was superseded
+    bool stop = false;
+    bool finished = false; // result is waiting for PollSave
+    SaveResult result;
+};
+
+int SaveText(Text const& text, LineEnding lineEnding, const char* filename,
+        uint64_t* outHash, size_t* outSize, std::atomic<bool> const* cancel);
+
+void StartSaver(Saver& saver, const char* filename);
+uint64_t QueueSave(Saver& saver, Text const& text, LineEnding lineEnding);
+bool PollSave(Saver& saver, SaveResult* out);
+void StopSaver(Saver& saver);
+
+#endif // SAVE_H_
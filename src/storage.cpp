@@ -0,0 +1,65 @@
+#include "storage.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+TextBlock::~TextBlock() {
+    if (release != NULL) release(data, size);
+    else free(data);
+}
+
+// takes ownership of buff
+// unique across every text, loaders build theirs on other threads
+uint64_t NextTextVersion() {
+    static std::atomic<uint64_t> last{0};
+    return ++last;
+}
+
+std::shared_ptr<TextBlock> AdoptTextBlock(char* buff, size_t n) {
+    std::shared_ptr<TextBlock> block = std::make_shared<TextBlock>();
+    block->data = buff;
+    block->size = n;
+    IndexNewlines(buff, n, 0, block->newlines);
+    return block;
+}
+
+static int CountTrailingZeros(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int) i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// appends base+i for every s[i] == '\n'
+void IndexNewlines(const char* s, size_t n, size_t base, std::vector<size_t>& out) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i const nl = _mm256_set1_epi8('\n');
+    for (; i+32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)(s+i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        for (; mask != 0; mask &= mask-1)
+            out.push_back(base + i + CountTrailingZeros(mask));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i const nl = _mm_set1_epi8('\n');
+    for (; i+16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i const*)(s+i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        for (; mask != 0; mask &= mask-1)
+            out.push_back(base + i + CountTrailingZeros(mask));
+    }
+#endif
+    for (; i < n; ++i) {
+        if (s[i] == '\n')
+            out.push_back(base + i);
+    }
+}
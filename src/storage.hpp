@@ -0,0 +1,59 @@
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <concepts>
+#include <memory>
+#include <vector>
+
+// shared by every text storage backend
+
+struct CursorPos {
+    size_t ln, col;
+};
+
+// every backend has a version, a new one after every change, equal versions
+// mean equal text, so whatever was worked out from a text can be kept until it
+// changes, copies keep the version of what they were copied from
+uint64_t NextTextVersion();
+
+// a backend provides size(), version and operator[] (returning something
+// indexable with size()), as well as the LoadText, InsertCStr, EraseBetween, CountBetween
+// and CopyBetween overloads
+// PosToOffset and OffsetToPos convert between positions and byte offsets in
+// O(log n), TextBytes gives the size of the whole text in O(1)
+// everything is resolved at compile time, there is no common base class
+template <typename T>
+concept TextStorage = requires(T& text, T const& ctext, CursorPos& curPos, CursorPos pos,
+    const char* s, char* buff, size_t n)
+{
+    { ctext.size() } -> std::convertible_to<size_t>;
+    { ctext.version } -> std::convertible_to<uint64_t>;
+    { ctext[n].size() } -> std::convertible_to<size_t>;
+    { ctext[n][n] } -> std::convertible_to<char>;
+    LoadText(text, buff, n);
+    InsertCStr(text, curPos, s, n);
+    EraseBetween(text, pos, pos);
+    { CountBetween(ctext, pos, pos) } -> std::convertible_to<size_t>;
+    CopyBetween(ctext, pos, pos, buff);
+    { PosToOffset(ctext, pos) } -> std::convertible_to<size_t>;
+    { OffsetToPos(ctext, n) } -> std::same_as<CursorPos>;
+    { TextBytes(ctext) } -> std::convertible_to<size_t>;
+};
+
+// a read buffer adopted as is, normally the contents of a file
+struct TextBlock {
+    char* data;
+    size_t size;
+    std::vector<size_t> newlines; // offset of every '\n' in data
+    // frees data when set, for blocks that are not malloc'd such as mappings
+    void (*release)(const char* data, size_t size) = NULL;
+
+    ~TextBlock();
+};
+
+std::shared_ptr<TextBlock> AdoptTextBlock(char* buff, size_t n);
+void IndexNewlines(const char* s, size_t n, size_t base, std::vector<size_t>& out);
+
+#endif // STORAGE_H_
@@ -0,0 +1,683 @@
+#include "undo.hpp"
+#include "coldstore.hpp"
+#include "config.hpp"
+#include "error.hpp"
+#include "file.hpp"
+#include "recovery.hpp"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// journaled to recovery unless it is NULL
+static void ApplyOp(RecoveryLog* recovery, Text& text, EditOp const& op, bool inverse) {
+    bool insert = (op.kind == EDIT_INSERT) != inverse;
+    CursorPos begin = OffsetToPos(text, op.offset);
+    if (insert) {
+        InsertCStr(text, begin, op.bytes.data(), op.bytes.size());
+        if (recovery != NULL)
+            RecoverEdit(*recovery, RECOVERY_INSERT, op.offset, op.bytes.data(), op.bytes.size());
+    }
+    else {
+        CursorPos end = OffsetToPos(text, op.offset + op.bytes.size());
+        EraseBetween(text, begin, end);
+        if (recovery != NULL)
+            RecoverEdit(*recovery, RECOVERY_ERASE, op.offset, NULL, op.bytes.size());
+    }
+}
+
+static void ApplyTransaction(UndoLog const& log, Text& text, Transaction const& t, bool inverse) {
+    if (inverse) {
+        for (size_t i = t.ops.size(); i-- > 0;)
+            ApplyOp(log.recovery, text, t.ops[i], true);
+    }
+    else {
+        for (EditOp const& op : t.ops)
+            ApplyOp(log.recovery, text, op, false);
+    }
+}
+
+static uint64_t OpsBytes(std::vector<EditOp> const& ops) {
+    uint64_t n = 0;
+    for (EditOp const& op : ops)
+        n += sizeof(EditOp) + op.bytes.size();
+    return n;
+}
+
+// checkpoints of immer text share most of their nodes with the buffer, but
+// not the line index, one settled with SettleCheckpoint has its own
+static uint64_t CheckpointBytes(Buffer const& state) {
+#if TEXT_STORAGE == TEXT_STORAGE_IMMER
+    LineIndex const* index = state.text.index.get();
+    if (index == NULL) return 0;
+    return index->nodes.capacity()*sizeof(IndexNode) + index->freeNodes.capacity()*sizeof(uint32_t);
+#elif TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+    // and so does the original of a piece table, only pieces are copied
+    PieceTable const& t = state.text;
+    return t.pieces.size()*sizeof(Piece) + t.added.size() + t.addedNewlines.size()*sizeof(size_t);
+#else
+    return TextBytes(state.text);
+#endif
+}
+
+static void Append(std::vector<char>& out, const void* p, size_t n) {
+    out.insert(out.end(), (const char*) p, (const char*) p + n);
+}
+
+// ops serialized and compressed the same way for the journal and the history
+static void PackOps(std::vector<EditOp> const& ops, std::vector<char>& packed, uint64_t* rawSize) {
+    std::vector<char> raw;
+    uint64_t count = ops.size();
+    Append(raw, &count, sizeof(count));
+    for (EditOp const& op : ops) {
+        uint8_t kind = op.kind;
+        uint64_t offset = op.offset, size = op.bytes.size();
+        Append(raw, &kind, sizeof(kind));
+        Append(raw, &offset, sizeof(offset));
+        Append(raw, &size, sizeof(size));
+        Append(raw, op.bytes.data(), size);
+    }
+    packed.resize(LZBound(raw.size()));
+    packed.resize(LZCompress(raw.data(), raw.size(), packed.data()));
+    *rawSize = raw.size();
+}
+
+static bool UnpackOps(const char* packed, uint64_t size, uint64_t rawSize, std::vector<EditOp>& ops) {
+    std::vector<char> raw(rawSize);
+    if (LZDecompress(packed, size, raw.data(), raw.size()) != raw.size())
+        return false;
+    const char* p = raw.data();
+    const char* end = p + raw.size();
+    uint64_t count;
+    if (raw.size() < sizeof(count)) return false;
+    memcpy(&count, p, sizeof(count)); p += sizeof(count);
+    ops.clear();
+    while (count-- > 0) {
+        uint8_t kind;
+        uint64_t offset, n;
+        if ((size_t)(end - p) < sizeof(kind) + sizeof(offset) + sizeof(n)) return false;
+        memcpy(&kind, p, sizeof(kind)); p += sizeof(kind);
+        memcpy(&offset, p, sizeof(offset)); p += sizeof(offset);
+        memcpy(&n, p, sizeof(n)); p += sizeof(n);
+        if ((uint64_t)(end - p) < n) return false;
+        ops.push_back((EditOp) { (EditKind) kind, offset, std::vector<char>(p, p + n) });
+        p += n;
+    }
+    return true;
+}
+
+// the compressed ops of a transaction that isn't only in memory
+static bool ReadPacked(UndoLog const& log, Transaction const& t, std::vector<char>& packed) {
+    packed.resize(t.spillSize);
+    if (t.historyOffset != 0) {
+        memcpy(packed.data(), log.history + t.historyOffset, t.spillSize);
+        return true;
+    }
+    return fseek(log.journal, (long) t.spillOffset, SEEK_SET) == 0
+        && fread(packed.data(), 1, packed.size(), log.journal) == packed.size();
+}
+
+// moves the ops of transaction k to the journal, they are written only the
+// first time, a transaction never changes once something was made after it
+static bool Spill(UndoLog& log, size_t k) {
+    Transaction& t = log.transactions[k];
+    if (t.spillSize == 0) {
+        if (log.journal == NULL && (log.journal = tmpfile()) == NULL)
+            return false;
+        std::vector<char> packed;
+        uint64_t rawSize;
+        PackOps(t.ops, packed, &rawSize);
+        if (fseek(log.journal, 0, SEEK_END) != 0)
+            return false;
+        long offset = ftell(log.journal);
+        if (offset < 0 || fwrite(packed.data(), 1, packed.size(), log.journal) != packed.size())
+            return false;
+        t.spillOffset = offset;
+        t.spillSize = packed.size();
+        t.spillRaw = rawSize;
+    }
+    log.resident -= OpsBytes(t.ops);
+    t.ops = std::vector<EditOp>();
+    return true;
+}
+
+// the ops of transaction k, read back from the journal or the history file
+// if they aren't in memory
+static Transaction& Load(UndoLog& log, size_t k) {
+    Transaction& t = log.transactions[k];
+    if (!t.ops.empty() || t.spillSize == 0)
+        return t;
+    bool ok;
+    if (t.historyOffset != 0) {
+        ok = UnpackOps(log.history + t.historyOffset, t.spillSize, t.spillRaw, t.ops);
+    }
+    else {
+        std::vector<char> packed;
+        ok = ReadPacked(log, t, packed) && UnpackOps(packed.data(), packed.size(), t.spillRaw, t.ops);
+    }
+    if (!ok) {
+        PANIC_HERE("UNDO", "Couldn't read back undo history");
+    }
+    log.resident += OpsBytes(t.ops);
+    log.loaded.push_back(k);
+    return t;
+}
+
+// spills the ops loaded longest ago, except the newest transaction's which
+// may still be merged into, then drops checkpoints if that was not enough
+static void TrimUndo(UndoLog& log) {
+    size_t newest = log.transactions.size() - 1;
+    for (size_t n = log.loaded.size(); n > 0 && log.resident > UndoMemoryLimit; --n) {
+        size_t k = log.loaded.front();
+        log.loaded.pop_front();
+        if (k == newest || !Spill(log, k))
+            log.loaded.push_back(k);
+    }
+    while (log.resident > UndoMemoryLimit && log.checkpointsDropped + 1 < log.checkpoints.size()) {
+        Checkpoint& c = log.checkpoints[++log.checkpointsDropped];
+        log.resident -= CheckpointBytes(c.state) + OpsBytes(c.behind);
+        log.transactions[c.transaction].checkpoint = UNDO_NONE;
+        c.state = Buffer{};
+        c.behind = std::vector<EditOp>();
+    }
+}
+
+// applies the edits queued on checkpoint c, before its state is used
+static void SettleCheckpoint(UndoLog& log, size_t c) {
+    Checkpoint& cp = log.checkpoints[c];
+    if (cp.behind.empty()) return;
+    log.resident -= CheckpointBytes(cp.state) + OpsBytes(cp.behind);
+    for (EditOp const& op : cp.behind)
+        ApplyOp(NULL, cp.state.text, op, false);
+    cp.behind = std::vector<EditOp>();
+    log.resident += CheckpointBytes(cp.state);
+}
+
+// forgets all history, buffer becomes the root and the first checkpoint
+void ResetUndo(UndoLog& log, Buffer const& buffer) {
+    Transaction root = {};
+    root.before = root.after = buffer.cursor;
+    root.parent = UNDO_NONE;
+    root.redo = UNDO_NONE;
+    root.checkpoint = 0;
+    log.transactions.clear();
+    log.transactions.push_back(std::move(root));
+    log.current = 0;
+    log.pending = Transaction{};
+    log.checkpoints.clear();
+    log.checkpoints.push_back((Checkpoint) { 0, buffer });
+    log.resident = 0;
+    log.loaded.clear();
+    log.checkpointsDropped = 0;
+    if (log.journal != NULL) {
+        fclose(log.journal);
+        log.journal = NULL;
+    }
+    UnmapFile(log.history, log.historySize);
+    log.history = NULL;
+    log.historySize = 0;
+    log.timeBase = 0;
+    log.saved = 0;
+}
+
+// remembers where the cursor was before the edits of the next transaction
+void BeginEdit(UndoLog& log, Cursor const& cursor) {
+    if (log.pending.ops.empty())
+        log.pending.before = cursor;
+}
+
+void RecordInsert(UndoLog& log, Text& text, CursorPos& curPos, const char* s, size_t n) {
+    if (n == 0) return;
+    EditOp op = { EDIT_INSERT, PosToOffset(text, curPos), std::vector<char>(s, s+n) };
+    InsertCStr(text, curPos, s, n);
+    if (log.recovery != NULL)
+        RecoverEdit(*log.recovery, RECOVERY_INSERT, op.offset, s, n);
+    log.pending.ops.push_back(std::move(op));
+}
+
+void RecordErase(UndoLog& log, Text& text, CursorPos begin, CursorPos end) {
+    size_t b = PosToOffset(text, begin);
+    size_t e = PosToOffset(text, end);
+    if (b == e) return;
+    EditOp op = { EDIT_ERASE, b, std::vector<char>(e-b) };
+    CopyBetween(text, begin, end, op.bytes.data());
+    EraseBetween(text, begin, end);
+    if (log.recovery != NULL)
+        RecoverEdit(*log.recovery, RECOVERY_ERASE, b, NULL, e-b);
+    log.pending.ops.push_back(std::move(op));
+}
+
+static bool IsSingleLineOp(Transaction const& t) {
+    return t.ops.size() == 1 && memchr(t.ops[0].bytes.data(), '\n', t.ops[0].bytes.size()) == NULL;
+}
+
+static bool IsWordBreak(char prev, char next) {
+    return isspace((unsigned char) prev) && !isspace((unsigned char) next);
+}
+
+// typing or deleting a run of characters in one place, within UndoMergeWindow
+// of each other and without crossing into a new word, ends up as one entry
+// commands made of several edits are never merged, so they stay atomic
+static bool MergeInto(Transaction& prev, Transaction& next) {
+    if (!IsSingleLineOp(prev) || !IsSingleLineOp(next)) return false;
+    if (next.time - prev.time > UndoMergeWindow) return false;
+    CursorPos p = prev.after.curPos, q = next.before.curPos;
+    if (p.ln != q.ln || p.col != q.col) return false;
+
+    EditOp& a = prev.ops[0];
+    EditOp& b = next.ops[0];
+    if (a.kind != b.kind) return false;
+    if (a.kind == EDIT_INSERT) {
+        if (b.offset != a.offset + a.bytes.size() || IsWordBreak(a.bytes.back(), b.bytes[0]))
+            return false;
+        a.bytes.insert(a.bytes.end(), b.bytes.begin(), b.bytes.end());
+    }
+    else if (b.offset + b.bytes.size() == a.offset) {
+        // backspace
+        if (IsWordBreak(b.bytes.back(), a.bytes[0]))
+            return false;
+        a.bytes.insert(a.bytes.begin(), b.bytes.begin(), b.bytes.end());
+        a.offset = b.offset;
+    }
+    else if (b.offset == a.offset) {
+        // delete
+        if (IsWordBreak(a.bytes.back(), b.bytes[0]))
+            return false;
+        a.bytes.insert(a.bytes.end(), b.bytes.begin(), b.bytes.end());
+    }
+    else {
+        return false;
+    }
+    prev.after = next.after;
+    prev.time = next.time;
+    return true;
+}
+
+// closes the pending transaction as a new child of the current one
+static void CloseTransaction(UndoLog& log, Buffer const& buffer, uint64_t now, bool merge) {
+    if (log.pending.ops.empty()) return;
+    log.pending.after = buffer.cursor;
+    log.pending.time = now;
+    // only the newest transaction grows, its children and the order of
+    // transaction times would not survive anything else changing, nor would
+    // the saved file still match the one it was saved at
+    size_t cur = log.current;
+    uint64_t merged = OpsBytes(log.transactions[cur].ops);
+    if (merge && cur > 0 && cur != log.saved && cur+1 == log.transactions.size() && MergeInto(log.transactions[cur], log.pending)) {
+        log.resident += OpsBytes(log.transactions[cur].ops) - merged;
+        // a copy saved before is out of date now
+        log.transactions[cur].spillSize = 0;
+        log.transactions[cur].historyOffset = 0;
+        // and so is the checkpoint, until the edit is replayed onto it
+        size_t c = log.transactions[cur].checkpoint;
+        if (c != UNDO_NONE) {
+            log.resident += OpsBytes(log.pending.ops);
+            log.checkpoints[c].behind.push_back(std::move(log.pending.ops[0]));
+        }
+        log.pending = Transaction{};
+        TrimUndo(log);
+        return;
+    }
+    Transaction t = std::move(log.pending);
+    log.pending = Transaction{};
+    t.parent = cur;
+    t.depth = log.transactions[cur].depth + 1;
+    t.redo = UNDO_NONE;
+    t.checkpoint = UNDO_NONE;
+    size_t k = log.transactions.size();
+    if (t.depth % UNDO_CHECKPOINT_INTERVAL == 0) {
+        t.checkpoint = log.checkpoints.size();
+        log.checkpoints.push_back((Checkpoint) { k, buffer });
+        // the copy, not the buffer, the buffer's index isn't copied with it
+        log.resident += CheckpointBytes(log.checkpoints.back().state);
+    }
+    log.resident += OpsBytes(t.ops);
+    log.loaded.push_back(k);
+    log.transactions.push_back(std::move(t));
+    log.transactions[cur].redo = k;
+    log.current = k;
+    TrimUndo(log);
+}
+
+void CommitEdit(UndoLog& log, Buffer const& buffer, uint64_t now) {
+    CloseTransaction(log, buffer, log.timeBase + now, true);
+}
+
+// never merged with the edit before it, for edits that did not come from
+// typing, such as a reload
+void CommitSeparateEdit(UndoLog& log, Buffer const& buffer, uint64_t now) {
+    CloseTransaction(log, buffer, log.timeBase + now, false);
+}
+
+// edits recorded but not committed yet still become their own transaction
+static void FlushPending(UndoLog& log, Buffer const& buffer) {
+    CloseTransaction(log, buffer, log.transactions.back().time, false);
+}
+
+// the text is being saved as it is now, SaveUndo will say the file holds the
+// current transaction even if editing goes on before it is called
+void MarkSaved(UndoLog& log, Buffer const& buffer) {
+    FlushPending(log, buffer);
+    log.saved = log.current;
+}
+
+bool Undo(UndoLog& log, Buffer& buffer) {
+    FlushPending(log, buffer);
+    Transaction const& t = Load(log, log.current);
+    if (t.parent == UNDO_NONE) return false;
+    ApplyTransaction(log, buffer.text, t, true);
+    buffer.cursor = t.before;
+    log.transactions[t.parent].redo = log.current;
+    log.current = t.parent;
+    TrimUndo(log);
+    return true;
+}
+
+bool Redo(UndoLog& log, Buffer& buffer) {
+    FlushPending(log, buffer);
+    size_t k = log.transactions[log.current].redo;
+    if (k == UNDO_NONE) return false;
+    Transaction const& t = Load(log, k);
+    ApplyTransaction(log, buffer.text, t, false);
+    buffer.cursor = t.after;
+    log.current = k;
+    TrimUndo(log);
+    return true;
+}
+
+// moves to any transaction in the tree, either by undoing up to the common
+// ancestor and redoing down the other branch, or by starting over from the
+// closest checkpoint above the target, whichever replays fewer transactions
+void RestoreTransaction(UndoLog& log, Buffer& buffer, size_t transaction) {
+    assert(transaction < log.transactions.size());
+    FlushPending(log, buffer);
+    std::vector<Transaction>& ts = log.transactions;
+
+    std::vector<size_t> replay;
+    size_t c = transaction;
+    while (c != UNDO_NONE && ts[c].checkpoint == UNDO_NONE) {
+        replay.push_back(c);
+        c = ts[c].parent;
+    }
+    // history loaded from a file only has a checkpoint where it was saved
+    size_t budget = c != UNDO_NONE ? replay.size() : SIZE_MAX;
+
+    std::vector<size_t> up, down;
+    size_t a = log.current, b = transaction;
+    while (a != b && up.size() + down.size() <= budget) {
+        if (ts[a].depth >= ts[b].depth) {
+            up.push_back(a);
+            a = ts[a].parent;
+        }
+        else {
+            down.push_back(b);
+            b = ts[b].parent;
+        }
+    }
+
+    if (a == b && up.size() + down.size() <= budget) {
+        for (size_t k : up)
+            ApplyTransaction(log, buffer.text, Load(log, k), true);
+    }
+    else {
+        SettleCheckpoint(log, ts[c].checkpoint);
+        buffer = log.checkpoints[ts[c].checkpoint].state;
+        if (log.recovery != NULL) {
+            char* buff;
+            size_t n;
+            ExtractText(buffer.text, (CursorPos) { 0, 0 },
+                    (CursorPos) { buffer.text.size()-1, buffer.text[buffer.text.size()-1].size() },
+                    &buff, &n);
+            RecoverEdit(*log.recovery, RECOVERY_RESET, 0, buff, n);
+            free(buff);
+        }
+        down = std::move(replay);
+    }
+    for (size_t i = down.size(); i-- > 0;) {
+        Transaction const& t = Load(log, down[i]);
+        ApplyTransaction(log, buffer.text, t, false);
+        ts[t.parent].redo = down[i];
+    }
+    buffer.cursor = ts[transaction].after;
+    log.current = transaction;
+    TrimUndo(log);
+}
+
+// the newest transaction made at or before time, transactions are created in
+// time order since only the newest one is ever merged into
+size_t TransactionAt(UndoLog const& log, uint64_t time) {
+    size_t lo = 1, hi = log.transactions.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (log.transactions[mid].time <= time) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+// jumps to the buffer as it was ms before (or after, if positive) the
+// current state was made, across branches if that is where editing happened
+void TimeTravel(UndoLog& log, Buffer& buffer, int64_t ms) {
+    FlushPending(log, buffer);
+    uint64_t time = log.transactions[log.current].time;
+    if (ms < 0 && (uint64_t) -ms > time) time = 0;
+    else time += ms;
+    RestoreTransaction(log, buffer, TransactionAt(log, time));
+}
+
+#if TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+// the original grew at its end, see LargeFile, every state in the history
+// shows the new part as well, edits don't move since they are all before it
+void AppendOriginal(UndoLog& log, Buffer& buffer, size_t start, size_t n) {
+    AppendOriginal(buffer.text, start, n);
+    AppendOriginal(log.checkpoints[0].state.text, start, n);
+    for (size_t c = log.checkpointsDropped + 1; c < log.checkpoints.size(); ++c) {
+        Buffer& state = log.checkpoints[c].state;
+        log.resident -= CheckpointBytes(state);
+        AppendOriginal(state.text, start, n);
+        log.resident += CheckpointBytes(state);
+    }
+}
+#endif
+
+// not cryptographic, only tells whether a file changed since its history was
+// saved, eight bytes per step so it keeps up with reading the file
+uint64_t HashText(const char* s, size_t n) {
+    return HashTextEnd(HashTextPart(HashTextBegin(n), s, n));
+}
+
+// the same hash over a text passed in parts, all but the last a multiple of
+// eight bytes long, n is the size of the whole text
+uint64_t HashTextBegin(size_t n) {
+    return 0x9e3779b97f4a7c15ull ^ n;
+}
+
+uint64_t HashTextPart(uint64_t h, const char* s, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, s+i, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    for (; i < n; ++i)
+        h = (h ^ (unsigned char) s[i]) * 0x100000001b3ull;
+    return h;
+}
+
+uint64_t HashTextEnd(uint64_t h) {
+    return h ^ (h >> 29);
+}
+
+#define HISTORY_MAGIC "UNDOHST1"
+
+// the history file starts with a header, then the packed ops of each
+// transaction, then an index of every transaction the header points to
+struct HistoryHeader {
+    char magic[8];
+    uint64_t entrySize;
+    uint64_t hash, textSize; // of the text the history leads up to
+    uint64_t count, current;
+    uint64_t index;
+};
+
+struct HistoryEntry {
+    uint64_t parent, depth, redo, time;
+    uint64_t offset, size, rawSize; // of the packed ops
+    Cursor before, after;
+};
+
+// writes the history next to the file so the next session can undo past
+// where it loaded, ops already in the file are kept and new ones appended
+// after it, once most of the file is old indices it is rewritten whole
+// hash and textSize are of the file as saved at MarkSaved
+bool SaveUndo(UndoLog& log, Buffer const& buffer, const char* path, uint64_t hash, size_t textSize) {
+    FlushPending(log, buffer);
+    std::vector<Transaction>& ts = log.transactions;
+    uint64_t live = sizeof(HistoryHeader) + ts.size() * sizeof(HistoryEntry);
+    for (Transaction const& t : ts)
+        if (t.historyOffset != 0) live += t.spillSize;
+    bool append = log.history != NULL && log.historySize < 2 * live;
+
+    char* tmp = NULL;
+    FILE* fp = append ? fopen(path, "r+b") : NULL;
+    if (fp == NULL) {
+        append = false;
+        tmp = (char*) malloc(strlen(path) + 5);
+        sprintf(tmp, "%s.tmp", path);
+        fp = fopen(tmp, "wb");
+        if (fp == NULL) {
+            free(tmp);
+            return false;
+        }
+    }
+
+    HistoryHeader header = {};
+    bool ok = append ? fseek(fp, 0, SEEK_END) == 0 : fwrite(&header, sizeof(header), 1, fp) == 1;
+    std::vector<HistoryEntry> entries(ts.size());
+    std::vector<char> packed;
+    for (size_t k = 0; ok && k < ts.size(); ++k) {
+        Transaction const& t = ts[k];
+        HistoryEntry& e = entries[k];
+        e.parent = t.parent;
+        e.depth = t.depth;
+        e.redo = t.redo;
+        e.time = t.time;
+        e.offset = t.historyOffset;
+        e.size = t.spillSize;
+        e.rawSize = t.spillRaw;
+        e.before = t.before;
+        e.after = t.after;
+        if (k == 0 || (append && t.historyOffset != 0)) continue;
+
+        if (t.spillSize != 0) ok = ReadPacked(log, t, packed);
+        else PackOps(t.ops, packed, &e.rawSize);
+        long offset = ftell(fp);
+        ok = ok && offset > 0 && fwrite(packed.data(), 1, packed.size(), fp) == packed.size();
+        e.offset = offset;
+        e.size = packed.size();
+    }
+    long index = ftell(fp);
+    ok = ok && index > 0 && fwrite(entries.data(), sizeof(HistoryEntry), entries.size(), fp) == entries.size();
+
+    memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+    header.entrySize = sizeof(HistoryEntry);
+    header.hash = hash;
+    header.textSize = textSize;
+    header.count = ts.size();
+    header.current = log.saved;
+    header.index = index;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    if (tmp != NULL) {
+#ifdef _WIN32
+        if (ok) remove(path);
+#endif
+        ok = ok && rename(tmp, path) == 0;
+        if (!ok) remove(tmp);
+        free(tmp);
+    }
+    if (!ok) return false;
+
+    // the old mapping still holds the old file, even if it was replaced
+    size_t size;
+    const char* data = MapFileReadOnly(path, &size);
+    if (data == NULL) return false;
+    UnmapFile(log.history, log.historySize);
+    log.history = data;
+    log.historySize = size;
+    for (size_t k = 1; k < ts.size(); ++k) {
+        ts[k].historyOffset = entries[k].offset;
+        ts[k].spillSize = entries[k].size;
+        ts[k].spillRaw = entries[k].rawSize;
+    }
+    return true;
+}
+
+// picks up the history saved by SaveUndo if it leads up to exactly the text
+// that was loaded, only the index is read, ops are paged in as undo gets to
+// them, the loaded text is the only checkpoint
+bool LoadUndo(UndoLog& log, Buffer const& buffer, const char* path, uint64_t hash, size_t textSize) {
+    size_t size;
+    const char* data = MapFileReadOnly(path, &size);
+    if (data == NULL) return false;
+
+    HistoryHeader header;
+    bool ok = size >= sizeof(header);
+    if (ok) {
+        memcpy(&header, data, sizeof(header));
+        ok = memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) == 0
+            && header.entrySize == sizeof(HistoryEntry)
+            && header.hash == hash && header.textSize == textSize
+            && header.count > 0 && header.current < header.count
+            && header.index >= sizeof(header) && header.index <= size
+            && (size - header.index) / sizeof(HistoryEntry) >= header.count;
+    }
+
+    std::vector<Transaction> ts(ok ? header.count : 0);
+    for (size_t k = 0; ok && k < ts.size(); ++k) {
+        HistoryEntry e;
+        memcpy(&e, data + header.index + k * sizeof(e), sizeof(e));
+        if (k == 0) {
+            ok = e.parent == UNDO_NONE && e.depth == 0;
+        }
+        else {
+            ok = e.parent < k && e.depth == ts[e.parent].depth + 1
+                && e.time >= ts[k-1].time
+                && e.size > 0 && e.rawSize / 256 <= e.size
+                && e.offset >= sizeof(header) && e.offset <= header.index
+                && e.size <= header.index - e.offset;
+        }
+        ok = ok && (e.redo == UNDO_NONE || (e.redo > k && e.redo < ts.size()));
+        Transaction& t = ts[k];
+        t.before = e.before;
+        t.after = e.after;
+        t.time = e.time;
+        t.parent = e.parent;
+        t.depth = e.depth;
+        t.redo = e.redo;
+        t.checkpoint = UNDO_NONE;
+        t.historyOffset = e.offset;
+        t.spillSize = e.size;
+        t.spillRaw = e.rawSize;
+    }
+    for (size_t k = 0; ok && k < ts.size(); ++k)
+        ok = ts[k].redo == UNDO_NONE || ts[ts[k].redo].parent == k;
+    if (!ok) {
+        UnmapFile(data, size);
+        return false;
+    }
+
+    ResetUndo(log, buffer);
+    log.transactions = std::move(ts);
+    log.current = header.current;
+    log.saved = header.current;
+    log.transactions[log.current].checkpoint = 0;
+    log.checkpoints[0].transaction = log.current;
+    log.history = data;
+    log.historySize = size;
+    log.timeBase = log.transactions.back().time + 1;
+    return true;
+}
@@ -0,0 +1,105 @@
+#ifndef UNDO_H_
+#define UNDO_H_
+
+#include "buffer.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <vector>
+
+struct RecoveryLog;
+
+// a full copy of the buffer is kept every this many levels of the tree
+#define UNDO_CHECKPOINT_INTERVAL 256
+#define UNDO_NONE SIZE_MAX
+
+enum EditKind {
+    EDIT_INSERT,
+    EDIT_ERASE,
+};
+
+// bytes inserted at or erased from a document offset
+struct EditOp {
+    EditKind kind;
+    size_t offset;
+    std::vector<char> bytes;
+};
+
+// everything one command changed, undone and redone as a whole
+// consecutive typing or deleting is merged into one, see CommitEdit
+// ops turn the parent's state into this one, so branches share their ancestors
+struct Transaction {
+    std::vector<EditOp> ops;
+    Cursor before, after;
+    uint64_t time; // ms, of the last edit merged in
+    size_t parent; // UNDO_NONE for the root
+    size_t depth;
+    size_t redo; // child Redo goes to, the one made or undone from last
+    size_t checkpoint; // index into checkpoints, or UNDO_NONE
+    // where the compressed ops are in the journal, or in the history file if
+    // historyOffset isn't 0, spillSize 0 if they never were written
+    // ops is empty while they are only there
+    uint64_t spillOffset, spillSize, spillRaw;
+    uint64_t historyOffset;
+};
+
+// the buffer as it was after transaction, with behind applied
+// edits merged into the transaction later are only queued on behind, so
+// typing on doesn't copy the buffer every keystroke
+struct Checkpoint {
+    size_t transaction;
+    Buffer state;
+    std::vector<EditOp> behind;
+};
+
+// edits are recorded as they are made, undoing applies their inverse, so
+// both cost O(edit size) no matter how big the buffer is
+// editing after an undo starts a new branch instead of dropping the redo
+// history, transactions[0] is the root and stands for the loaded file
+struct UndoLog {
+    std::vector<Transaction> transactions; // in creation order
+    size_t current;
+    Transaction pending;
+    std::vector<Checkpoint> checkpoints;
+    // past UndoMemoryLimit the ops loaded longest ago are spilled to the
+    // journal and checkpoints after the first are dropped, oldest first
+    uint64_t resident = 0;
+    std::deque<size_t> loaded; // transactions with ops in memory
+    size_t checkpointsDropped = 0;
+    FILE* journal = NULL; // an anonymous temporary file, made on first spill
+    // the history file saved last, mapped, see SaveUndo
+    const char* history = NULL;
+    size_t historySize = 0;
+    uint64_t timeBase = 0; // added to times so they keep growing across sessions
+    size_t saved = 0; // the transaction the file on disk holds, see MarkSaved
+    RecoveryLog* recovery = NULL; // every change to the text is journaled to it
+};
+
+void ResetUndo(UndoLog& log, Buffer const& buffer);
+void BeginEdit(UndoLog& log, Cursor const& cursor);
+void RecordInsert(UndoLog& log, Text& text, CursorPos& curPos, const char* s, size_t n);
+void RecordErase(UndoLog& log, Text& text, CursorPos begin, CursorPos end);
+void CommitEdit(UndoLog& log, Buffer const& buffer, uint64_t now);
+void CommitSeparateEdit(UndoLog& log, Buffer const& buffer, uint64_t now);
+
+bool Undo(UndoLog& log, Buffer& buffer);
+bool Redo(UndoLog& log, Buffer& buffer);
+void RestoreTransaction(UndoLog& log, Buffer& buffer, size_t transaction);
+size_t TransactionAt(UndoLog const& log, uint64_t time);
+void TimeTravel(UndoLog& log, Buffer& buffer, int64_t ms);
+#if TEXT_STORAGE == TEXT_STORAGE_PIECE_TABLE
+void AppendOriginal(UndoLog& log, Buffer& buffer, size_t start, size_t n);
+#endif
+
+void MarkSaved(UndoLog& log, Buffer const& buffer);
+
+uint64_t HashText(const char* s, size_t n);
+uint64_t HashTextBegin(size_t n);
+uint64_t HashTextPart(uint64_t h, const char* s, size_t n);
+uint64_t HashTextEnd(uint64_t h);
+bool SaveUndo(UndoLog& log, Buffer const& buffer, const char* path, uint64_t hash, size_t textSize);
+bool LoadUndo(UndoLog& log, Buffer const& buffer, const char* path, uint64_t hash, size_t textSize);
+
+#endif // UNDO_H_
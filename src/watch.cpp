@@ -0,0 +1,63 @@
+#include "watch.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// the file may not exist yet, the directory has to
+// a symlink is followed, writes go to the file it points at
+bool StartWatch(FileWatch& watch, const char* filename) {
+#ifdef __linux__
+    char* resolved = realpath(filename, NULL);
+    if (resolved != NULL) filename = resolved;
+    const char* slash = strrchr(filename, '/');
+    char* dir = slash != NULL ? strndup(filename, slash == filename ? 1 : slash - filename) : strdup(".");
+    watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    bool ok = watch.fd >= 0 && inotify_add_watch(watch.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) >= 0;
+    free(dir);
+    if (ok) watch.name = strdup(slash != NULL ? slash + 1 : filename);
+    free(resolved);
+    if (!ok) StopWatch(watch);
+    return ok;
+#else
+    (void) watch;
+    (void) filename;
+    return false;
+#endif
+}
+
+// never blocks, true if the file was written or replaced since the last poll,
+// including by saves of our own, which the caller tells apart
+bool PollWatch(FileWatch& watch) {
+    bool changed = false;
+#ifdef __linux__
+    if (watch.fd < 0) return false;
+    alignas(struct inotify_event) char buff[4096];
+    for (;;) {
+        ssize_t n = read(watch.fd, buff, sizeof(buff));
+        if (n <= 0) break;
+        for (char* p = buff; p < buff + n; ) {
+            struct inotify_event* e = (struct inotify_event*) p;
+            if ((e->mask & IN_Q_OVERFLOW) || (e->len > 0 && strcmp(e->name, watch.name) == 0))
+                changed = true;
+            p += sizeof(struct inotify_event) + e->len;
+        }
+    }
+#else
+    (void) watch;
+#endif
+    return changed;
+}
+
+void StopWatch(FileWatch& watch) {
+#ifdef __linux__
+    if (watch.fd >= 0) close(watch.fd);
+#endif
+    watch.fd = -1;
+    free(watch.name);
+    watch.name = NULL;
+}
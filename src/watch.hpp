@@ -0,0 +1,20 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// tells when another process may have written or replaced a file
+// the directory is watched rather than the file, saves that rename a new
+// file over it would leave a watch on the file itself on the old one
+// only inotify for now, elsewhere nothing is ever reported
+struct FileWatch {
+    int fd = -1;
+    char* name = NULL; // within the directory watched
+};
+
+bool StartWatch(FileWatch& watch, const char* filename);
+bool PollWatch(FileWatch& watch);
+void StopWatch(FileWatch& watch);
+
+#endif // WATCH_H_
@@ -0,0 +1,163 @@
+// reloads texts from edited copies of their files and checks the result
+// usage: test-reload, exits with 1 if any case fails
+
+#include "reload.hpp"
+#include "format.hpp"
+#include "undo.hpp"
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEMP_FILE "test-reload.tmp"
+
+struct ShiftCheck {
+    size_t from, to;
+};
+
+struct ReloadCase {
+    const char* name;
+    const char* before; // the file as it was loaded
+    const char* after; // the file reloaded
+    std::vector<ShiftCheck> shifts; // where some lines of before end up
+};
+
+static const ReloadCase cases[] = {
+    { "edit at the top", "a\nb\nc\nd\n", "x\nb\nc\nd\n", { { 1, 1 }, { 3, 3 } } },
+    { "insert at the top", "a\nb\nc\n", "x\ny\na\nb\nc\n", { { 0, 2 }, { 2, 4 } } },
+    { "erase at the top", "a\nb\nc\nd\n", "c\nd\n", { { 2, 0 }, { 3, 1 } } },
+    { "edit in the middle", "a\nb\nc\nd\ne\n", "a\nb\nx\nd\ne\n", { { 1, 1 }, { 2, 2 }, { 4, 4 } } },
+    { "insert in the middle", "a\nb\nc\nd\n", "a\nb\nx\ny\nz\nc\nd\n", { { 1, 1 }, { 2, 5 }, { 3, 6 } } },
+    { "erase in the middle", "a\nb\nc\nd\ne\n", "a\ne\n", { { 0, 0 }, { 2, 1 }, { 4, 1 } } },
+    { "edit at the bottom", "a\nb\nc\nd", "a\nb\nc\nx", { { 2, 2 }, { 3, 3 } } },
+    { "append lines", "a\nb", "a\nb\nc\nd", { { 1, 1 } } },
+    // a dropped line goes to the one after its hunk, past the end here
+    { "drop the last lines", "a\nb\nc\nd", "a\nb", { { 1, 1 }, { 3, 2 } } },
+    { "two hunks", "a\nb\nc\nd\ne\nf\n", "x\nb\nc\ne\nf\ny\n", { { 1, 1 }, { 4, 3 }, { 5, 4 } } },
+    { "add the trailing newline", "a\nb", "a\nb\n", { { 0, 0 }, { 1, 1 } } },
+    { "remove the trailing newline", "a\nb\n", "a\nb", { { 0, 0 }, { 1, 1 } } },
+    { "crlf edit", "a\r\nb\r\nc\r\n", "a\r\nx\r\nc\r\n", { { 0, 0 }, { 2, 2 } } },
+    { "crlf insert", "a\r\nb\r\n", "a\r\nx\r\nb\r\n", { { 1, 2 } } },
+    { "crlf trailing newline", "a\r\nb", "a\r\nb\r\n", { { 0, 0 } } },
+    { "lf to crlf", "a\nb\n", "a\r\nb\r\n", {} },
+    { "crlf to lf", "a\r\nb\r\n", "a\nb\n", {} },
+    { "empty to text", "", "a\nb\n", {} },
+    { "text to empty", "a\nb\n", "", { { 1, 0 } } },
+    { "empty to empty", "", "", { { 0, 0 } } },
+    { "same", "a\nb\nc\n", "a\nb\nc\n", { { 1, 1 }, { 2, 2 } } },
+    { "blank lines", "\n\n\n", "\n\nx\n\n", { { 0, 0 }, { 2, 3 } } },
+};
+
+static std::string Decode(const char* s, TextFormat* format) {
+    std::string decoded = s;
+    decoded.resize(DecodeText(decoded.data(), decoded.size(), format));
+    return decoded;
+}
+
+static std::string Flatten(Text const& text) {
+    CursorPos end = { text.size()-1, text[text.size()-1].size() };
+    std::string s(CountBetween(text, (CursorPos) { 0, 0 }, end), '\0');
+    CopyBetween(text, (CursorPos) { 0, 0 }, end, s.data());
+    return s;
+}
+
+static std::string LineText(Text const& text, size_t ln) {
+    std::string s(text[ln].size(), '\0');
+    CopyBetween(text, (CursorPos) { ln, 0 }, (CursorPos) { ln, text[ln].size() }, s.data());
+    return s;
+}
+
+static bool WriteFile(const char* path, const char* s) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) return false;
+    size_t n = strlen(s);
+    bool ok = fwrite(s, 1, n, f) == n;
+    return fclose(f) == 0 && ok;
+}
+
+static bool InHunk(std::vector<Hunk> const& hunks, size_t ln) {
+    for (Hunk const& h : hunks)
+        if (h.line <= ln && ln < h.line + h.oldCount) return true;
+    return false;
+}
+
+static bool Run(ReloadCase const& c) {
+    TextFormat format;
+    std::string before = Decode(c.before, &format);
+    Buffer buffer;
+    char* buff = (char*) malloc(before.size()+1);
+    memcpy(buff, before.data(), before.size());
+    LoadText(buffer.text, buff, before.size());
+    buffer.format = format;
+    buffer.cursor = {};
+    UndoLog undo;
+    ResetUndo(undo, buffer);
+    std::vector<std::string> oldLines;
+    for (size_t ln = 0; ln < buffer.text.size(); ++ln)
+        oldLines.push_back(LineText(buffer.text, ln));
+
+    if (!WriteFile(TEMP_FILE, c.after)) {
+        fprintf(stderr, "ERROR: can't write %s\n", TEMP_FILE);
+        return false;
+    }
+    std::vector<Hunk> hunks;
+    uint64_t hash;
+    if (ReloadText(undo, buffer, TEMP_FILE, 1000, hunks, &hash) != 0) {
+        fprintf(stderr, "FAIL %s: reload failed\n", c.name);
+        return false;
+    }
+
+    TextFormat afterFormat;
+    std::string after = Decode(c.after, &afterFormat);
+    std::string text = Flatten(buffer.text);
+    if (text != after) {
+        fprintf(stderr, "FAIL %s: text is \"%s\", the file \"%s\"\n", c.name, text.c_str(), after.c_str());
+        return false;
+    }
+    if (hash != HashText(after.data(), after.size())) {
+        fprintf(stderr, "FAIL %s: hash differs from the file's\n", c.name);
+        return false;
+    }
+    if (buffer.format.lineEnding != afterFormat.lineEnding) {
+        fprintf(stderr, "FAIL %s: line ending not taken from the file\n", c.name);
+        return false;
+    }
+
+    // lines no hunk touched are where ShiftLine says
+    for (size_t ln = 0; ln < oldLines.size(); ++ln) {
+        size_t to = ShiftLine(hunks, ln);
+        if (InHunk(hunks, ln)) continue;
+        if (to >= buffer.text.size() || LineText(buffer.text, to) != oldLines[ln]) {
+            fprintf(stderr, "FAIL %s: line %zu shifted to %zu, which differs\n", c.name, ln, to);
+            return false;
+        }
+    }
+    for (ShiftCheck s : c.shifts) {
+        size_t to = ShiftLine(hunks, s.from);
+        if (to != s.to) {
+            fprintf(stderr, "FAIL %s: line %zu shifted to %zu, not %zu\n", c.name, s.from, to, s.to);
+            return false;
+        }
+    }
+
+    // the reload is one edit
+    if (!hunks.empty() && (!Undo(undo, buffer) || Flatten(buffer.text) != before)) {
+        fprintf(stderr, "FAIL %s: undo doesn't give back the text before\n", c.name);
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    size_t failed = 0;
+    size_t numCases = sizeof(cases)/sizeof(cases[0]);
+    for (size_t i = 0; i < numCases; ++i) {
+        if (!Run(cases[i])) ++failed;
+    }
+    remove(TEMP_FILE);
+    printf("%zu/%zu reload cases passed\n", numCases-failed, numCases);
+    return failed > 0 ? 1 : 0;
+}